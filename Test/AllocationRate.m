@@ -0,0 +1,63 @@
+#include "Test.h"
+#include <stdio.h>
+
+// Reports how quickly objects can be allocated and checks that whether a
+// class uses the fast ARC path is recomputed when a superclass gains or
+// changes its reference counting methods.
+
+#define OBJECTS 1000000
+
+@interface Fast : Test @end
+@implementation Fast @end
+@interface FastSub : Fast @end
+@implementation FastSub @end
+
+static int retainCount;
+
+static id countingRetain(id self, SEL _cmd)
+{
+	retainCount++;
+	return self;
+}
+
+static void arcCompliant(id self, SEL _cmd) {}
+
+// Returns whether sending objc_retain() to a new instance of cls calls the
+// class's -retain method.
+static BOOL retainIsSent(Class cls)
+{
+	id obj = class_createInstance(cls, 0);
+	int count = retainCount;
+	objc_retain(obj);
+	object_dispose(obj);
+	return count != retainCount;
+}
+
+int main(void)
+{
+	Class cls = [FastSub class];
+	double start = now();
+	for (int i=0 ; i<OBJECTS ; i++)
+	{
+		object_dispose(class_createInstance(cls, 0));
+	}
+	double ms = elapsed_ms(start);
+	fprintf(stderr, "Allocated %d objects in %.1fms (%.1fns each)\n",
+	        OBJECTS, ms, ms * 1e6 / OBJECTS);
+
+	assert(!retainIsSent(cls));
+	// Adding -retain to the superclass must take the subclass off the fast
+	// path.
+	class_addMethod([Fast class], @selector(retain), (IMP)countingRetain, "@@:");
+	assert(retainIsSent(cls));
+	assert(retainIsSent([Fast class]));
+	// Marking the new method as ARC compliant puts it back.
+	class_addMethod([Fast class], sel_registerName("_ARCCompliantRetainRelease"),
+			(IMP)arcCompliant, "v@:");
+	assert(!retainIsSent(cls));
+	// Replacing the marker's implementation does not change anything.
+	class_replaceMethod([Fast class], sel_registerName("_ARCCompliantRetainRelease"),
+			(IMP)arcCompliant, "v@:");
+	assert(!retainIsSent(cls));
+	return 0;
+}
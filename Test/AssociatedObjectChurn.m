@@ -0,0 +1,64 @@
+#include "Test.h"
+#include <pthread.h>
+
+// Checks that associated objects can be read while another thread repeatedly
+// removes them and adds enough keys to make the table grow, which frees the
+// tables that the readers may be probing.
+
+#define KEYS 32
+#define ROUNDS 20000
+#define READERS 4
+
+static char keys[KEYS];
+static id object;
+static id values[KEYS];
+static volatile int done;
+
+static void *reader(void *arg)
+{
+	while (!done)
+	{
+		for (int i=0 ; i<KEYS ; i++)
+		{
+			id value = objc_getAssociatedObject(object, &keys[i]);
+			assert((nil == value) || (values[i] == value));
+		}
+	}
+	return NULL;
+}
+
+int main(void)
+{
+	object = [Test new];
+	for (int i=0 ; i<KEYS ; i++)
+	{
+		values[i] = [Test new];
+	}
+	pthread_t threads[READERS];
+	for (int i=0 ; i<READERS ; i++)
+	{
+		int error = pthread_create(&threads[i], NULL, reader, NULL);
+		assert(0 == error);
+	}
+	for (int n=0 ; n<ROUNDS ; n++)
+	{
+		for (int i=0 ; i<KEYS ; i++)
+		{
+			objc_setAssociatedObject(object, &keys[i], values[i],
+					OBJC_ASSOCIATION_ASSIGN);
+		}
+		objc_removeAssociatedObjects(object);
+	}
+	done = 1;
+	for (int i=0 ; i<READERS ; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+	for (int i=0 ; i<KEYS ; i++)
+	{
+		assert(nil == objc_getAssociatedObject(object, &keys[i]));
+		[values[i] release];
+	}
+	[object release];
+	return 0;
+}
@@ -0,0 +1,84 @@
+#include "Test.h"
+#include <stdio.h>
+
+#define OBJECTS 64
+#define SENDS 100000
+
+static char key;
+static int deallocCount;
+
+@interface Counted : Test
+@end
+
+@implementation Counted
+- (void)dealloc
+{
+	deallocCount++;
+	[super dealloc];
+}
+@end
+
+@interface Receiver : Test
+- (int)value;
+@end
+
+@implementation Receiver
+- (int)value { return 1; }
+@end
+
+static void sendMessages(id *objects, const char *label)
+{
+	// Count the distinct classes that the objects' isa pointers refer to.  A
+	// call site that only ever sees one class keeps hitting in its cache.
+	int distinct = 0;
+	for (int i=0 ; i<OBJECTS ; i++)
+	{
+		BOOL seen = NO;
+		for (int j=0 ; j<i ; j++)
+		{
+			seen |= (objects[i]->isa == objects[j]->isa);
+		}
+		distinct += !seen;
+	}
+	int total = 0;
+	double start = now();
+	for (int i=0 ; i<SENDS ; i++)
+	{
+		for (int j=0 ; j<OBJECTS ; j++)
+		{
+			total += [objects[j] value];
+		}
+	}
+	double end = now();
+	assert(SENDS * OBJECTS == total);
+	double ns = end - start;
+	fprintf(stderr, "%s: %d receiver classes, %.2fns per message\n", label,
+			distinct, ns / ((double)SENDS * OBJECTS));
+}
+
+int main(void)
+{
+	id objects[OBJECTS];
+	for (int i=0 ; i<OBJECTS ; i++)
+	{
+		objects[i] = [Receiver new];
+	}
+	sendMessages(objects, "without associations");
+	for (int i=0 ; i<OBJECTS ; i++)
+	{
+		id value = [Counted new];
+		objc_setAssociatedObject(objects[i], &key, value,
+				OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+		[value release];
+		assert(object_getClass(objects[i]) == [Receiver class]);
+	}
+	sendMessages(objects, "with associations");
+	for (int i=0 ; i<OBJECTS ; i++)
+	{
+		assert(nil != objc_getAssociatedObject(objects[i], &key));
+		[objects[i] release];
+	}
+	// Destroying the objects must release their associated objects.
+	assert(OBJECTS == deallocCount);
+	return 0;
+}
@@ -0,0 +1,83 @@
+#include "Test.h"
+#include <stdio.h>
+
+#define MAX_KEYS 50
+#define LOOKUPS 1000000
+
+static char keys[MAX_KEYS];
+static int deallocCount;
+
+@interface Counted : Test
+@end
+
+@implementation Counted
+- (void)dealloc
+{
+	deallocCount++;
+	[super dealloc];
+}
+@end
+
+static void benchmark(int keyCount)
+{
+	id obj = [Test new];
+	id values[MAX_KEYS];
+	for (int i=0 ; i<keyCount ; i++)
+	{
+		values[i] = [Test new];
+		objc_setAssociatedObject(obj, &keys[i], values[i],
+				OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+	}
+	double start = now();
+	for (int i=0 ; i<LOOKUPS ; i++)
+	{
+		int k = i % keyCount;
+		assert(values[k] == objc_getAssociatedObject(obj, &keys[k]));
+	}
+	double ns = now() - start;
+	fprintf(stderr, "%d keys: %.1fns per lookup\n", keyCount, ns / LOOKUPS);
+	[obj release];
+	for (int i=0 ; i<keyCount ; i++)
+	{
+		[values[i] release];
+	}
+}
+
+int main(void)
+{
+	@autoreleasepool
+	{
+		id obj = [Test new];
+		// Add enough keys to force the table to grow several times, with a mix
+		// of policies.
+		for (int i=0 ; i<MAX_KEYS ; i++)
+		{
+			id value = [Counted new];
+			objc_setAssociatedObject(obj, &keys[i], value,
+					(i & 1) ? OBJC_ASSOCIATION_RETAIN : OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+			[value release];
+		}
+		assert(0 == deallocCount);
+		for (int i=0 ; i<MAX_KEYS ; i++)
+		{
+			assert(nil != objc_getAssociatedObject(obj, &keys[i]));
+		}
+		assert(nil == objc_getAssociatedObject(obj, &deallocCount));
+		// Replacing a value must release the old one.
+		objc_setAssociatedObject(obj, &keys[0], nil,
+				OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+		assert(1 == deallocCount);
+		assert(nil == objc_getAssociatedObject(obj, &keys[0]));
+		objc_removeAssociatedObjects(obj);
+		assert(MAX_KEYS == deallocCount);
+		assert(nil == objc_getAssociatedObject(obj, &keys[1]));
+		// The object can still be given new associations afterwards.
+		objc_setAssociatedObject(obj, &keys[2], obj, OBJC_ASSOCIATION_ASSIGN);
+		assert(obj == objc_getAssociatedObject(obj, &keys[2]));
+		[obj release];
+	}
+	benchmark(1);
+	benchmark(10);
+	benchmark(50);
+	return 0;
+}
@@ -0,0 +1,59 @@
+#include "Test.h"
+#include <stdio.h>
+
+#define OBJECTS 1000000
+
+static char key;
+static int deallocCount;
+
+@interface Counted : Test
+@end
+
+@implementation Counted
+- (void)dealloc
+{
+	deallocCount++;
+	[super dealloc];
+}
+@end
+
+static int extraMethod(id self, SEL _cmd)
+{
+	return 42;
+}
+
+int main(void)
+{
+	id value = [Counted new];
+	double start = now();
+	for (int i=0 ; i<OBJECTS ; i++)
+	{
+		id obj = [Test new];
+		objc_setAssociatedObject(obj, &key, value,
+				OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+		[obj release];
+	}
+	double end = now();
+	// Every object must have released its association.
+	assert(0 == deallocCount);
+	[value release];
+	assert(1 == deallocCount);
+	double ns = end - start;
+	fprintf(stderr, "%.1fns to create and destroy an object with an association\n",
+			ns / OBJECTS);
+
+	// Objects with methods of their own must still be torn down correctly, and
+	// the methods must not be visible on other objects.
+	SEL sel = sel_registerName("extraMethod");
+	for (int i=0 ; i<1000 ; i++)
+	{
+		id obj = [Test new];
+		object_addMethod_np(obj, sel, (IMP)extraMethod, "i@:");
+		assert(42 == ((int(*)(id,SEL))objc_msgSend)(obj, sel));
+		[obj release];
+		id other = [Test new];
+		assert(!class_respondsToSelector(object_getClass(other), sel));
+		[other release];
+	}
+	return 0;
+}
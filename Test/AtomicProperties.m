@@ -0,0 +1,83 @@
+#include "Test.h"
+#include <pthread.h>
+#include <stdio.h>
+
+#define THREADS 8
+#define ITERATIONS 200000
+#define VALUES 4
+
+struct Quad
+{
+	long a, b, c, d;
+};
+
+@interface Holder : Test
+{
+	id value;
+	struct Quad quad;
+}
+@property (atomic, retain) id value;
+@property (atomic) struct Quad quad;
+@end
+
+@implementation Holder
+@synthesize value;
+@synthesize quad;
+@end
+
+static Holder *holder;
+static id values[VALUES];
+
+static void *worker(void *arg)
+{
+	intptr_t thread = (intptr_t)arg;
+	for (int i=0 ; i<ITERATIONS ; i++)
+	{
+		@autoreleasepool
+		{
+			long n = thread * ITERATIONS + i;
+			if (i & 1)
+			{
+				holder.value = values[n % VALUES];
+				struct Quad q = { n, n, n, n };
+				holder.quad = q;
+			}
+			else
+			{
+				id v = holder.value;
+				assert((v == values[0]) || (v == values[1]) ||
+				       (v == values[2]) || (v == values[3]));
+				// Atomic structure properties must never be torn.
+				struct Quad q = holder.quad;
+				assert((q.a == q.b) && (q.b == q.c) && (q.c == q.d));
+			}
+		}
+	}
+	return NULL;
+}
+
+int main(void)
+{
+	for (int i=0 ; i<VALUES ; i++)
+	{
+		values[i] = [Test new];
+	}
+	holder = [Holder new];
+	holder.value = values[0];
+
+	pthread_t threads[THREADS];
+	double start = now();
+	for (intptr_t i=0 ; i<THREADS ; i++)
+	{
+		int error = pthread_create(&threads[i], NULL, worker, (void*)i);
+		assert(0 == error);
+	}
+	for (int i=0 ; i<THREADS ; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+	double ns = now() - start;
+	fprintf(stderr, "%d threads: %.1fns per contended atomic property access\n",
+			THREADS, ns / ((double)THREADS * ITERATIONS));
+	return 0;
+}
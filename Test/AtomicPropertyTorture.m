@@ -0,0 +1,105 @@
+#include "Test.h"
+#include <pthread.h>
+#include <stdio.h>
+
+#define THREADS 8
+#define ITERATIONS 100000
+
+static const long alive = 0x600DF00D;
+static const long dead = 0xDEADBEEF;
+
+@interface Value : Test
+{
+	@public
+	long magic;
+}
+@end
+
+@implementation Value
+- (void)dealloc
+{
+	magic = dead;
+	[super dealloc];
+}
+@end
+
+/**
+ * Overriding -retain stops the runtime from using the fast ARC path for this
+ * class, so atomic getters must fall back to the locked path.
+ */
+@interface SlowValue : Value
+@end
+
+@implementation SlowValue
+- (id)retain
+{
+	return [super retain];
+}
+@end
+
+@interface Holder : Test
+{
+	id value;
+}
+@property (atomic, retain) id value;
+@end
+
+@implementation Holder
+@synthesize value;
+@end
+
+static Holder *holder;
+
+static void *worker(void *arg)
+{
+	intptr_t thread = (intptr_t)arg;
+	Class cls = (thread & 2) ? [SlowValue class] : [Value class];
+	for (int i=0 ; i<ITERATIONS ; i++)
+	{
+		@autoreleasepool
+		{
+			if (thread & 1)
+			{
+				Value *v = [cls new];
+				v->magic = alive;
+				holder.value = v;
+				[v release];
+			}
+			else
+			{
+				// The value must not have been deallocated before the getter
+				// retained it.
+				Value *v = holder.value;
+				assert(alive == v->magic);
+			}
+		}
+	}
+	return NULL;
+}
+
+int main(void)
+{
+	holder = [Holder new];
+	Value *v = [Value new];
+	v->magic = alive;
+	holder.value = v;
+	[v release];
+
+	pthread_t threads[THREADS];
+	double start = now();
+	for (intptr_t i=0 ; i<THREADS ; i++)
+	{
+		int error = pthread_create(&threads[i], NULL, worker, (void*)i);
+		assert(0 == error);
+	}
+	for (int i=0 ; i<THREADS ; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+	double ns = now() - start;
+	fprintf(stderr, "%d threads: %.1fns per contended atomic object property access\n",
+			THREADS, ns / ((double)THREADS * ITERATIONS));
+	holder.value = nil;
+	[holder release];
+	return 0;
+}
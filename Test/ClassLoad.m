@@ -0,0 +1,42 @@
+#include "Test.h"
+#include <stdio.h>
+
+// Measures how long it takes to load a module with a large number of classes,
+// each of which is defined before its superclass.  The classes are defined in
+// a file generated by ClassLoadClasses.cmake.
+
+#define CLASSES 20000
+
+static double start;
+
+// Runs before the constructors that load the Objective-C modules.
+__attribute__((constructor(101)))
+static void start_timer(void)
+{
+	start = now();
+}
+
+int main(void)
+{
+	fprintf(stderr, "Loaded %d classes in %.1fms\n", CLASSES, elapsed_ms(start));
+	char name[32];
+	for (int i=0 ; i<CLASSES ; i++)
+	{
+		snprintf(name, sizeof(name), "Load%d", i);
+		Class cls = objc_getClass(name);
+		assert(Nil != cls);
+		Class super = [Test class];
+		if (i > 0)
+		{
+			snprintf(name, sizeof(name), "Load%d", (i - 1) / 2);
+			super = objc_getClass(name);
+		}
+		assert(class_getSuperclass(cls) == super);
+		// Each class adds one ivar after those of its superclass.
+		snprintf(name, sizeof(name), "ivar%d", i);
+		Ivar ivar = class_getInstanceVariable(cls, name);
+		assert(ivar_getOffset(ivar) >= class_getInstanceSize(super));
+		assert(class_getInstanceSize(cls) > class_getInstanceSize(super));
+	}
+	return 0;
+}
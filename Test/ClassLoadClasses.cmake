@@ -0,0 +1,36 @@
+# Generates an Objective-C file defining CLASS_LOAD_COUNT classes for the
+# ClassLoad benchmark.  Class i inherits from class (i-1)/2, so the classes
+# form a binary tree rooted at Test.  The implementations are emitted in
+# reverse order, so every class is loaded before its superclass.
+
+file(WRITE ${CLASS_LOAD_SOURCE}
+"// Generated by ClassLoadClasses.cmake.  Do not edit.
+#ifndef __has_attribute
+#define __has_attribute(x) 0
+#endif
+#if __has_attribute(objc_root_class)
+__attribute__((objc_root_class))
+#endif
+@interface Test { id isa; } @end
+@interface Load0 : Test { int ivar0; } @end
+")
+set(CHUNK "")
+math(EXPR LAST "${CLASS_LOAD_COUNT} - 1")
+foreach(I RANGE 1 ${LAST})
+	math(EXPR SUPER "(${I} - 1) / 2")
+	string(APPEND CHUNK "@interface Load${I} : Load${SUPER} { int ivar${I}; } @end\n")
+	math(EXPR FLUSH "${I} % 1000")
+	if (FLUSH EQUAL 0)
+		file(APPEND ${CLASS_LOAD_SOURCE} "${CHUNK}")
+		set(CHUNK "")
+	endif ()
+endforeach()
+foreach(I RANGE ${LAST} 0 -1)
+	string(APPEND CHUNK "@implementation Load${I} @end\n")
+	math(EXPR FLUSH "${I} % 1000")
+	if (FLUSH EQUAL 0)
+		file(APPEND ${CLASS_LOAD_SOURCE} "${CHUNK}")
+		set(CHUNK "")
+	endif ()
+endforeach()
+file(APPEND ${CLASS_LOAD_SOURCE} "${CHUNK}")
@@ -0,0 +1,115 @@
+#include "Test.h"
+#include "../objc/hooks.h"
+#include <stdio.h>
+
+// Compares creating objects with class_createInstances() against a loop of
+// class_createInstance() calls, and checks that every object gets its class
+// and has the C++ constructors of its class and superclasses run in order,
+// including when the allocator runs out of memory part way through a batch.
+
+#define ITERATIONS 100
+#define BATCH 10000
+
+@interface Base : Test
+{
+	@public
+	int constructed;
+	int order;
+}
+@end
+@implementation Base @end
+@interface Derived : Base @end
+@implementation Derived @end
+
+static void constructBase(Base *self, SEL _cmd)
+{
+	self->constructed++;
+	self->order = 1;
+}
+
+static void constructDerived(Base *self, SEL _cmd)
+{
+	self->constructed++;
+	assert(1 == self->order);
+	self->order = 2;
+}
+
+static id objects[BATCH];
+
+#define ALLOCATION_LIMIT 3
+static int allocations;
+
+static BOOL failAfterLimit(Class cls, size_t extraBytes)
+{
+	return allocations++ < ALLOCATION_LIMIT;
+}
+
+int main(void)
+{
+	SEL construct = sel_registerName(".cxx_construct");
+	class_addMethod([Base class], construct, (IMP)constructBase, "v@:");
+	class_addMethod([Derived class], construct, (IMP)constructDerived, "v@:");
+	Class cls = [Derived class];
+
+	double start = now();
+	for (int n=0 ; n<ITERATIONS ; n++)
+	{
+		for (int i=0 ; i<BATCH ; i++)
+		{
+			objects[i] = class_createInstance(cls, 0);
+		}
+		for (int i=0 ; i<BATCH ; i++)
+		{
+			object_dispose(objects[i]);
+		}
+	}
+	double single = elapsed_ms(start);
+	start = now();
+	for (int n=0 ; n<ITERATIONS ; n++)
+	{
+		unsigned created = class_createInstances(cls, 0, objects, BATCH);
+		assert(BATCH == created);
+		for (int i=0 ; i<BATCH ; i++)
+		{
+			object_dispose(objects[i]);
+		}
+	}
+	double batch = elapsed_ms(start);
+	fprintf(stderr, "%d objects: %.1fms one at a time, %.1fms in batches of %d\n",
+	        ITERATIONS * BATCH, single, batch, BATCH);
+
+	unsigned created = class_createInstances(cls, 16, objects, BATCH);
+	assert(BATCH == created);
+	for (int i=0 ; i<BATCH ; i++)
+	{
+		Base *obj = objects[i];
+		assert(object_getClass(obj) == cls);
+		assert(2 == obj->constructed);
+		assert(2 == obj->order);
+		assert(0 == ((char*)object_getIndexedIvars(obj))[15]);
+		object_dispose(obj);
+	}
+	created = class_createInstances(cls, 0, objects, 0);
+	assert(0 == created);
+	created = class_createInstances(Nil, 0, objects, BATCH);
+	assert(0 == created);
+
+	// If the allocator fails, then only the objects before the failure are
+	// returned, and they are fully initialised.
+	_objc_allocation_hook = failAfterLimit;
+	created = class_createInstances(cls, 0, objects, BATCH);
+	assert(ALLOCATION_LIMIT == created);
+	for (unsigned i=0 ; i<created ; i++)
+	{
+		Base *obj = objects[i];
+		assert(object_getClass(obj) == cls);
+		assert(2 == obj->constructed);
+		object_dispose(obj);
+	}
+	assert(nil == class_createInstance(cls, 0));
+	_objc_allocation_hook = NULL;
+	id obj = class_createInstance(cls, 0);
+	assert(nil != obj);
+	object_dispose(obj);
+	return 0;
+}
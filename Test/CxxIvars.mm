@@ -0,0 +1,116 @@
+#include "Test.h"
+#include <stdio.h>
+
+// Reports the cost of allocating and freeing objects with C++ instance
+// variables, compared with objects without them, and checks that the C++
+// constructors and destructors run in the correct order, including for
+// objects allocated before their class is initialised and after a destructor
+// is added at run time.
+
+#define OBJECTS 1000000
+
+static int constructed;
+static int destroyed;
+static int order;
+
+struct Counted
+{
+	int value;
+	int rank;
+	Counted(int r) : value(42), rank(r)
+	{
+		assert(order == rank - 1);
+		order = rank;
+		constructed++;
+	}
+	~Counted()
+	{
+		assert(order == rank);
+		order = rank - 1;
+		destroyed++;
+	}
+};
+
+struct BaseIvar : Counted { BaseIvar() : Counted(1) {} };
+struct DerivedIvar : Counted { DerivedIvar() : Counted(2) {} };
+
+@interface Base : Test
+{
+	@public
+	BaseIvar base;
+}
+@end
+@implementation Base @end
+
+@interface Derived : Base
+{
+	@public
+	DerivedIvar derived;
+}
+@end
+@implementation Derived @end
+
+@interface Plain : Test
+{
+	int x;
+}
+@end
+@implementation Plain @end
+
+static int plainDestroyed;
+
+static void destroyPlain(id self, SEL _cmd)
+{
+	plainDestroyed++;
+}
+
+static double time_allocations(Class cls)
+{
+	double start = now();
+	for (int i=0 ; i<OBJECTS ; i++)
+	{
+		object_dispose(class_createInstance(cls, 0));
+	}
+	return (now() - start) / OBJECTS;
+}
+
+int main(void)
+{
+	// Allocating an object does not initialise its class, so the C++ ivars
+	// must be handled without the class's methods being in its dtable, and
+	// that must not stop them being handled once it is initialised.
+	Class derived = objc_getClass("Derived");
+	for (int i=0 ; i<2 ; i++)
+	{
+		Derived *early = class_createInstance(derived, 0);
+		assert(42 == early->base.value);
+		assert(42 == early->derived.value);
+		assert(2 == order);
+		object_dispose(early);
+		assert(0 == order);
+	}
+	assert(2 == constructed);
+	assert(2 == destroyed);
+	constructed = destroyed = 0;
+
+	double withCxx = time_allocations([Derived class]);
+	double withoutCxx = time_allocations([Plain class]);
+	fprintf(stderr, "Allocate and free: %.1fns with C++ ivars, %.1fns without\n",
+	        withCxx, withoutCxx);
+	assert(2 * OBJECTS == constructed);
+	assert(2 * OBJECTS == destroyed);
+
+	Derived *obj = class_createInstance([Derived class], 0);
+	assert(42 == obj->base.value);
+	assert(42 == obj->derived.value);
+	assert(2 == order);
+	object_dispose(obj);
+	assert(0 == order);
+
+	// A destructor added after the class has been used must be called.
+	class_addMethod([Plain class], sel_registerName(".cxx_destruct"),
+			(IMP)destroyPlain, "v@:");
+	object_dispose(class_createInstance([Plain class], 0));
+	assert(1 == plainDestroyed);
+	return 0;
+}
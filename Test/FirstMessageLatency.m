@@ -0,0 +1,98 @@
+#include "Test.h"
+#include <stdio.h>
+#include <unistd.h>
+
+// Loaded classes that do not implement +initialize are initialised in the
+// background, so the first message sent to them should cost about the same as
+// any other.  Reports the latency of the first message to loaded classes and
+// to classes created at run time, which are not pre-initialised, and checks
+// that classes that do implement +initialize still get it on first use.
+
+#define CLASS(n) \
+	@interface Plain##n : Test @end \
+	@implementation Plain##n \
+	+ (int)value { return n; } \
+	@end
+#define CLASSES4(n) CLASS(n##0) CLASS(n##1) CLASS(n##2) CLASS(n##3)
+#define CLASSES16(n) CLASSES4(n##0) CLASSES4(n##1) CLASSES4(n##2) CLASSES4(n##3)
+
+CLASSES16(1)
+CLASSES16(2)
+CLASSES16(3)
+CLASSES16(4)
+
+static int initializeCount;
+static int subclassInitializeCount;
+
+@interface WithInit : Test @end
+@implementation WithInit
++ (void)initialize
+{
+	if (self == [WithInit class])
+	{
+		initializeCount++;
+	}
+	else
+	{
+		subclassInitializeCount++;
+	}
+}
+@end
+
+// Inherits +initialize, so must not be pre-initialised either.
+@interface WithInheritedInit : WithInit @end
+@implementation WithInheritedInit @end
+
+static int value(Class self, SEL _cmd) { return 0; }
+
+int main(void)
+{
+	static const char *loaded[] = {
+#define NAME(n) "Plain" #n,
+#define NAMES4(n) NAME(n##0) NAME(n##1) NAME(n##2) NAME(n##3)
+#define NAMES16(n) NAMES4(n##0) NAMES4(n##1) NAMES4(n##2) NAMES4(n##3)
+		NAMES16(1) NAMES16(2) NAMES16(3) NAMES16(4)
+	};
+	const int count = sizeof(loaded) / sizeof(*loaded);
+	SEL sel = @selector(value);
+	Class created[count];
+	char name[32];
+	for (int i=0 ; i<count ; i++)
+	{
+		snprintf(name, sizeof(name), "Created%d", i);
+		created[i] = objc_allocateClassPair([Test class], name, 0);
+		class_addMethod(object_getClass((id)created[i]), sel, (IMP)value, "i@:");
+		objc_registerClassPair(created[i]);
+	}
+	// Give the background thread a chance to run.
+	usleep(100000);
+	assert(0 == initializeCount);
+	assert(0 == subclassInitializeCount);
+
+	double start = now();
+	for (int i=0 ; i<count ; i++)
+	{
+		id cls = (id)objc_getClass(loaded[i]);
+		((int(*)(id, SEL))objc_msg_lookup(cls, sel))(cls, sel);
+	}
+	double loadedTime = (now() - start) / 1e3;
+	start = now();
+	for (int i=0 ; i<count ; i++)
+	{
+		id cls = (id)created[i];
+		((int(*)(id, SEL))objc_msg_lookup(cls, sel))(cls, sel);
+	}
+	double createdTime = (now() - start) / 1e3;
+	fprintf(stderr, "First message: %.2fus per loaded class, %.2fus per created class\n",
+	        loadedTime / count, createdTime / count);
+
+	assert(123 == [Plain123 value]);
+	[WithInheritedInit class];
+	assert(1 == initializeCount);
+	assert(1 == subclassInitializeCount);
+	[WithInit class];
+	[WithInheritedInit class];
+	assert(1 == initializeCount);
+	assert(1 == subclassInitializeCount);
+	return 0;
+}
@@ -0,0 +1,83 @@
+#include "Test.h"
+#include <stdio.h>
+
+// Creates a large number of classes with many methods, sends a few of them,
+// and reports how long it took to initialise the classes.  Also checks that
+// lookups that miss in a subclass still find the superclass's methods once
+// enough classes implement a selector for its dtable to become sparse.
+
+#define CLASSES 3000
+#define METHODS 50
+#define SENT 10
+
+static long base(id self, SEL _cmd) { return 1; }
+static long override(id self, SEL _cmd) { return 2; }
+
+static SEL sels[METHODS];
+
+static long send(id obj, SEL sel)
+{
+	return ((long(*)(id, SEL))objc_msg_lookup(obj, sel))(obj, sel);
+}
+
+int main(void)
+{
+	static Class classes[CLASSES];
+	static id objects[CLASSES];
+	char name[32];
+	for (int i=0 ; i<METHODS ; i++)
+	{
+		snprintf(name, sizeof(name), "method%d", i);
+		sels[i] = sel_registerName(name);
+	}
+	double start = now();
+	for (int i=0 ; i<CLASSES ; i++)
+	{
+		// Every other class is a subclass of the previous one and only
+		// implements some of the methods itself.
+		BOOL subclass = (i & 1);
+		Class super = subclass ? classes[i-1] : [Test class];
+		snprintf(name, sizeof(name), "Lazy%d", i);
+		Class cls = objc_allocateClassPair(super, name, 0);
+		for (int m=subclass ? METHODS/2 : 0 ; m<METHODS ; m++)
+		{
+			class_addMethod(cls, sels[m], (IMP)(subclass ? override : base), "q@:");
+		}
+		objc_registerClassPair(cls);
+		classes[i] = cls;
+	}
+	fprintf(stderr, "Created %d classes in %.1fms\n", CLASSES, elapsed_ms(start));
+	start = now();
+	for (int i=0 ; i<CLASSES ; i++)
+	{
+		objects[i] = class_createInstance(classes[i], 0);
+		for (int m=0 ; m<SENT ; m++)
+		{
+			send(objects[i], sels[m]);
+		}
+	}
+	fprintf(stderr, "Initialised %d classes in %.1fms\n", CLASSES, elapsed_ms(start));
+
+	for (int i=0 ; i<CLASSES ; i++)
+	{
+		BOOL subclass = (i & 1);
+		for (int m=0 ; m<METHODS ; m++)
+		{
+			long expected = (subclass && (m >= METHODS/2)) ? 2 : 1;
+			assert(expected == send(objects[i], sels[m]));
+			assert(expected == send(objects[i], sels[m]));
+		}
+		assert(!class_respondsToSelector(classes[i], @selector(missing)));
+		assert(!class_respondsToSelector(classes[i], @selector(missing)));
+	}
+	// Methods added after a lookup has recorded that the class does not
+	// implement a selector must still be found.
+	class_addMethod(classes[1], sels[0], (IMP)override, "q@:");
+	assert(2 == send(objects[1], sels[0]));
+	assert(1 == send(objects[0], sels[0]));
+	class_addMethod(classes[2], @selector(missing), (IMP)override, "q@:");
+	assert(class_respondsToSelector(classes[2], @selector(missing)));
+	assert(class_respondsToSelector(classes[3], @selector(missing)));
+	assert(!class_respondsToSelector(classes[4], @selector(missing)));
+	return 0;
+}
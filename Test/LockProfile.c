@@ -0,0 +1,68 @@
+/**
+ * Tests the lock profiler.  The profiler is internal to the runtime, so this
+ * test is built with its own copy of lock_profile.c and LOCK_PROFILING
+ * defined, instead of linking against the library.
+ */
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "lock.h"
+
+extern int lock_profiling;
+void log_lock_profile(void);
+
+static mutex_t testLock;
+
+/**
+ * Writes the lock profile into buffer.
+ */
+static void read_profile(char *buffer, size_t size)
+{
+	FILE *log = tmpfile();
+	assert(NULL != log);
+	fflush(stderr);
+	int savedStderr = dup(2);
+	dup2(fileno(log), 2);
+	log_lock_profile();
+	fflush(stderr);
+	dup2(savedStderr, 2);
+	close(savedStderr);
+	rewind(log);
+	size_t length = fread(buffer, 1, size - 1, log);
+	buffer[length] = 0;
+	fclose(log);
+}
+
+int main(void)
+{
+	lock_profiling = 1;
+	INIT_LOCK(testLock);
+	int line = 0;
+	for (int i=0 ; i<3 ; i++)
+	{
+		line = __LINE__ + 1;
+		LOCK(&testLock);
+		UNLOCK(&testLock);
+	}
+	// Acquisitions while profiling is disabled are not recorded.
+	lock_profiling = 0;
+	LOCK(&testLock);
+	UNLOCK(&testLock);
+
+	char profile[4096];
+	read_profile(profile, sizeof(profile));
+	fputs(profile, stderr);
+	// The lock is reported with the name given to INIT_LOCK().
+	char *entry = strstr(profile, "lock testLock");
+	assert(NULL != entry);
+	assert(NULL != strstr(entry, ": 3 acquisitions, 0 contended"));
+	// The call site is reported with its count.
+	char site[64];
+	snprintf(site, sizeof(site), "LockProfile.c:%d: 3 acquisitions", line);
+	assert(NULL != strstr(entry, site));
+	return 0;
+}
@@ -0,0 +1,129 @@
+#include "Test.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Run with LIBOBJC_OBJECT_ALLOCATOR=pool.  Reports object allocation and
+// deallocation throughput compared with malloc() and free() of the same size,
+// and checks that reused objects are zeroed, including when they
+// are freed by a different thread from the one that allocated them.
+
+#define ITERATIONS 200
+#define BATCH 10000
+#define THREADS 4
+
+@interface Small : Test
+{
+	long a, b, c;
+}
+@end
+@implementation Small @end
+
+static id objects[BATCH];
+static void *blocks[BATCH];
+
+static void checkClean(id obj, Class cls, size_t extra)
+{
+	size_t size = class_getInstanceSize(cls) + extra;
+	char *bytes = (char*)obj;
+	for (size_t i=sizeof(id) ; i<size ; i++)
+	{
+		assert(0 == bytes[i]);
+	}
+}
+
+static void *freeObjects(void *arg)
+{
+	for (int i=0 ; i<BATCH ; i++)
+	{
+		object_dispose(objects[i]);
+	}
+	return NULL;
+}
+
+int main(void)
+{
+	Class cls = [Small class];
+	size_t size = class_getInstanceSize(cls);
+	double start = now();
+	for (int n=0 ; n<ITERATIONS ; n++)
+	{
+		for (int i=0 ; i<BATCH ; i++)
+		{
+			objects[i] = class_createInstance(cls, 0);
+		}
+		for (int i=0 ; i<BATCH ; i++)
+		{
+			object_dispose(objects[i]);
+		}
+	}
+	double objectTime = elapsed_ms(start);
+	start = now();
+	for (int n=0 ; n<ITERATIONS ; n++)
+	{
+		for (int i=0 ; i<BATCH ; i++)
+		{
+			blocks[i] = calloc(size + sizeof(void*), 1);
+		}
+		for (int i=0 ; i<BATCH ; i++)
+		{
+			free(blocks[i]);
+		}
+	}
+	double mallocTime = elapsed_ms(start);
+	fprintf(stderr, "%d allocations: %.1fms with class_createInstance, %.1fms with calloc\n",
+	        ITERATIONS * BATCH, objectTime, mallocTime);
+
+	// Dirty some objects, free them, and check that the objects that reuse
+	// their memory are clean.
+	for (int i=0 ; i<BATCH ; i++)
+	{
+		objects[i] = class_createInstance(cls, 0);
+		memset((char*)objects[i] + sizeof(id), 0xff, size - sizeof(id));
+	}
+	for (int i=0 ; i<BATCH ; i++)
+	{
+		object_dispose(objects[i]);
+	}
+	for (int i=0 ; i<BATCH ; i++)
+	{
+		objects[i] = class_createInstance(cls, 0);
+		assert(object_getClass(objects[i]) == cls);
+		checkClean(objects[i], cls, 0);
+		memset((char*)objects[i] + sizeof(id), 0xff, size - sizeof(id));
+	}
+	// Free them from other threads, which give the memory back to the global
+	// free lists when they exit.
+	pthread_t threads[THREADS];
+	for (int t=0 ; t<THREADS ; t++)
+	{
+		pthread_create(&threads[t], NULL, freeObjects, NULL);
+		pthread_join(threads[t], NULL);
+		for (int i=0 ; i<BATCH ; i++)
+		{
+			objects[i] = class_createInstance(cls, 0);
+			checkClean(objects[i], cls, 0);
+			memset((char*)objects[i] + sizeof(id), 0xff, size - sizeof(id));
+		}
+	}
+	freeObjects(NULL);
+	// Objects allocated together.
+	unsigned created = class_createInstances(cls, 0, objects, BATCH);
+	assert(BATCH == created);
+	for (int i=0 ; i<BATCH ; i++)
+	{
+		assert(object_getClass(objects[i]) == cls);
+		checkClean(objects[i], cls, 0);
+	}
+	freeObjects(NULL);
+	// Objects that are too big for the pool.
+	for (int i=0 ; i<10 ; i++)
+	{
+		id obj = class_createInstance(cls, 4096);
+		checkClean(obj, cls, 4096);
+		memset((char*)obj + sizeof(id), 0xff, size - sizeof(id) + 4096);
+		object_dispose(obj);
+	}
+	return 0;
+}
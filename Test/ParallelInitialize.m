@@ -0,0 +1,89 @@
+#include "Test.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+
+// Sends messages to many classes from many threads at once.  Each +initialize
+// is slow, so if unrelated classes were initialised one at a time then this
+// would take CLASSES * INITIALIZE_US.  Checks that +initialize runs exactly
+// once for each class and that no thread can send a message to a class before
+// its +initialize has finished.
+
+#define CLASSES 256
+#define THREADS 32
+#define INITIALIZE_US 2000
+
+static Class classes[CLASSES];
+static int initializeCount[CLASSES];
+static int initialized[CLASSES];
+
+static int indexForClass(Class cls)
+{
+	int i;
+	sscanf(class_getName(cls), "Init%d", &i);
+	return i;
+}
+
+static void initialize(Class self, SEL _cmd)
+{
+	int i = indexForClass(self);
+	__sync_fetch_and_add(&initializeCount[i], 1);
+	usleep(INITIALIZE_US);
+	__atomic_store_n(&initialized[i], 1, __ATOMIC_RELEASE);
+}
+
+static int check(Class self, SEL _cmd)
+{
+	return __atomic_load_n(&initialized[indexForClass(self)], __ATOMIC_ACQUIRE);
+}
+
+static void *sendMessages(void *arg)
+{
+	int start = (int)(intptr_t)arg * (CLASSES / THREADS);
+	SEL sel = sel_registerName("check");
+	for (int n=0 ; n<CLASSES ; n++)
+	{
+		id cls = (id)classes[(start + n) % CLASSES];
+		int (*imp)(id, SEL) = (int(*)(id, SEL))objc_msg_lookup(cls, sel);
+		assert(1 == imp(cls, sel));
+	}
+	return NULL;
+}
+
+int main(void)
+{
+	char name[32];
+	for (int i=0 ; i<CLASSES ; i++)
+	{
+		// Every other class is a subclass of the previous one, so some threads
+		// also have to wait for a superclass.
+		Class super = (i & 1) ? classes[i-1] : [Test class];
+		snprintf(name, sizeof(name), "Init%d", i);
+		Class cls = objc_allocateClassPair(super, name, 0);
+		class_addMethod(object_getClass((id)cls), @selector(initialize),
+				(IMP)initialize, "v@:");
+		class_addMethod(object_getClass((id)cls), sel_registerName("check"),
+				(IMP)check, "i@:");
+		objc_registerClassPair(cls);
+		classes[i] = cls;
+	}
+	double start = now();
+	pthread_t threads[THREADS];
+	for (int i=0 ; i<THREADS ; i++)
+	{
+		pthread_create(&threads[i], NULL, sendMessages, (void*)(intptr_t)i);
+	}
+	for (int i=0 ; i<THREADS ; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+	double end = now();
+	fprintf(stderr, "Initialised %d classes from %d threads in %.1fms\n",
+	        CLASSES, THREADS,
+	        (end - start) / 1e6);
+	for (int i=0 ; i<CLASSES ; i++)
+	{
+		assert(1 == initializeCount[i]);
+	}
+	return 0;
+}
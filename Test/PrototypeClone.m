@@ -0,0 +1,81 @@
+#include "Test.h"
+#include <stdio.h>
+
+#define CLONES 10000
+
+static char key;
+static int deallocCount;
+
+@interface Prototype : Test
+@end
+
+@implementation Prototype
+- (void)dealloc
+{
+	deallocCount++;
+	[super dealloc];
+}
+@end
+
+static int protoMethod(id self, SEL _cmd)
+{
+	return 1;
+}
+
+static int cloneMethod(id self, SEL _cmd)
+{
+	return 2;
+}
+
+int main(void)
+{
+	SEL sel = sel_registerName("value");
+	id proto = [Prototype new];
+	id assoc = [Test new];
+	objc_setAssociatedObject(proto, &key, assoc, OBJC_ASSOCIATION_ASSIGN);
+	object_addMethod_np(proto, sel, (IMP)protoMethod, "i@:");
+
+	id clones[CLONES];
+	double start = now();
+	for (int i=0 ; i<CLONES ; i++)
+	{
+		clones[i] = object_clone_np(proto);
+	}
+	double ns = now() - start;
+	fprintf(stderr, "%.1fns per clone\n", ns / CLONES);
+	for (int i=0 ; i<CLONES ; i++)
+	{
+		// Clones inherit methods and associated objects from the prototype,
+		// and share a class until one of them diverges.
+		assert(proto == object_getPrototype_np(clones[i]));
+		assert([Prototype class] == object_getClass(clones[i]));
+		assert(clones[0]->isa == clones[i]->isa);
+		assert(1 == ((int(*)(id,SEL))objc_msgSend)(clones[i], sel));
+		assert(assoc == objc_getAssociatedObject(clones[i], &key));
+	}
+	assert(nil == object_getPrototype_np(proto));
+
+	// Adding a method to one clone must not affect the others.
+	object_addMethod_np(clones[0], sel, (IMP)cloneMethod, "i@:");
+	assert(2 == ((int(*)(id,SEL))objc_msgSend)(clones[0], sel));
+	assert(1 == ((int(*)(id,SEL))objc_msgSend)(clones[1], sel));
+	assert(proto == object_getPrototype_np(clones[0]));
+	assert(assoc == objc_getAssociatedObject(clones[0], &key));
+
+	// Clones of clones use their own prototype.
+	id grandchild = object_clone_np(clones[1]);
+	assert(clones[1] == object_getPrototype_np(grandchild));
+	assert(1 == ((int(*)(id,SEL))objc_msgSend)(grandchild, sel));
+	[grandchild release];
+
+	// The prototype stays alive until the last clone is destroyed.
+	[proto release];
+	for (int i=0 ; i<CLONES ; i++)
+	{
+		assert(0 == deallocCount);
+		[clones[i] release];
+	}
+	assert(1 == deallocCount);
+	[assoc release];
+	return 0;
+}
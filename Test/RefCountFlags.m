@@ -0,0 +1,58 @@
+#include "Test.h"
+
+static int deallocCount;
+static char key;
+
+@interface Counted : Test
+@end
+
+@implementation Counted
+- (void)dealloc
+{
+	deallocCount++;
+	[super dealloc];
+}
+@end
+
+int main(void)
+{
+	// An object that is never weakly referenced or given associated objects
+	// must still be deallocated exactly once, even if over-released.
+	id plain = [Counted new];
+	for (int i=0 ; i<1000 ; i++)
+	{
+		objc_retain(plain);
+	}
+	for (int i=0 ; i<1000 ; i++)
+	{
+		objc_release(plain);
+	}
+	assert(0 == deallocCount);
+	objc_release(plain);
+	assert(1 == deallocCount);
+
+	// Objects without associated objects return nil without a hidden class.
+	id obj = [Counted new];
+	Class cls = *(Class*)obj;
+	assert(nil == objc_getAssociatedObject(obj, &key));
+	assert(*(Class*)obj == cls);
+
+	// Associated objects are found once they have been set.
+	id value = [Test new];
+	objc_setAssociatedObject(obj, &key, value, OBJC_ASSOCIATION_RETAIN);
+	assert(value == objc_getAssociatedObject(obj, &key));
+	objc_release(value);
+
+	// A weakly referenced object zeroes its references on deallocation.
+	id weak = nil;
+	objc_initWeak(&weak, obj);
+	id loaded = objc_loadWeakRetained(&weak);
+	assert(loaded == obj);
+	objc_release(loaded);
+	objc_release(obj);
+	assert(2 == deallocCount);
+	assert(nil == weak);
+	// Retaining a deallocated object through a weak reference fails.
+	assert(nil == objc_loadWeakRetained(&weak));
+	return 0;
+}
@@ -0,0 +1,56 @@
+#include "Test.h"
+
+/**
+ * Enough references to fill the count field in the object header several
+ * times over when the library is built with a narrow REFCOUNT_BITS, so that
+ * part of the count moves to the side table and back.
+ */
+#define REFERENCES 100000
+
+static int deallocCount;
+
+@interface Counted : Test
+@end
+
+@implementation Counted
+- (void)dealloc
+{
+	deallocCount++;
+	[super dealloc];
+}
+@end
+
+int main(void)
+{
+	id obj = [Counted new];
+	id other = [Counted new];
+	assert(1 == object_getRetainCount_np(obj));
+	for (int i=0 ; i<REFERENCES ; i++)
+	{
+		objc_retain(obj);
+		assert(i + 2 == object_getRetainCount_np(obj));
+		// Interleave another object, so that the side table has more than
+		// one entry.
+		if (0 == (i & 1))
+		{
+			objc_retain(other);
+		}
+	}
+	for (int i=REFERENCES ; i>0 ; i--)
+	{
+		objc_release(obj);
+		assert(i == object_getRetainCount_np(obj));
+		assert(0 == deallocCount);
+	}
+	objc_release(obj);
+	assert(1 == deallocCount);
+	for (int i=0 ; i<REFERENCES ; i+=2)
+	{
+		objc_release(other);
+	}
+	assert(1 == object_getRetainCount_np(other));
+	assert(1 == deallocCount);
+	objc_release(other);
+	assert(2 == deallocCount);
+	return 0;
+}
@@ -0,0 +1,85 @@
+#include "Test.h"
+#include <stdio.h>
+
+// Simulates requests that each allocate and autorelease many objects, with
+// and without a region, and reports how long they take.  Checks that objects
+// in a region are still destroyed and have their weak references zeroed, and
+// that the region's memory is reused by the next region.
+
+#define OBJECTS 50000
+#define REQUESTS 20
+
+@interface Node : Test @end
+@implementation Node @end
+
+static int destroyed;
+
+static void destroyNode(id self, SEL _cmd)
+{
+	destroyed++;
+}
+
+static void request(Class cls)
+{
+	for (int i=0 ; i<OBJECTS ; i++)
+	{
+		objc_autorelease(class_createInstance(cls, 0));
+	}
+}
+
+int main(void)
+{
+	Class cls = [Node class];
+	class_addMethod(cls, sel_registerName(".cxx_destruct"), (IMP)destroyNode,
+			"v@:");
+
+	double start = now();
+	for (int i=0 ; i<REQUESTS ; i++)
+	{
+		void *pool = objc_autoreleasePoolPush();
+		request(cls);
+		objc_autoreleasePoolPop(pool);
+	}
+	double withoutRegion = elapsed_ms(start);
+	start = now();
+	for (int i=0 ; i<REQUESTS ; i++)
+	{
+		void *region = objc_region_push();
+		request(cls);
+		objc_region_pop(region);
+	}
+	double withRegion = elapsed_ms(start);
+	fprintf(stderr, "Request allocating %d objects: %.2fms without a region, %.2fms with one\n",
+	        OBJECTS, withoutRegion / REQUESTS, withRegion / REQUESTS);
+	assert(2 * REQUESTS * OBJECTS == destroyed);
+
+	// Weak references to objects in a region are zeroed when they are
+	// deallocated.
+	id weak = nil;
+	void *region = objc_region_push();
+	id obj = class_createInstance(cls, 0);
+	objc_storeWeak(&weak, obj);
+	objc_autorelease(obj);
+	objc_region_pop(region);
+	assert(nil == objc_loadWeak(&weak));
+
+	// Popping a region pops the regions inside it, and the next region reuses
+	// their memory.
+	destroyed = 0;
+	region = objc_region_push();
+	objc_region_push();
+	obj = class_createInstance(cls, 0);
+	objc_autorelease(obj);
+	objc_region_pop(region);
+	assert(1 == destroyed);
+	region = objc_region_push();
+	id reused = class_createInstance(cls, 0);
+	assert(obj == reused);
+	objc_release(reused);
+	objc_region_pop(region);
+	// Objects allocated outside a region are freed as usual.
+	obj = class_createInstance(cls, 0);
+	objc_release(obj);
+	assert(3 == destroyed);
+	return 0;
+}
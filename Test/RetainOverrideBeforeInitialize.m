@@ -0,0 +1,52 @@
+#include "Test.h"
+
+static int retainCount;
+
+@interface Override : Test
+@end
+
+@implementation Override
+- (id)retain
+{
+	retainCount++;
+	return self;
+}
+@end
+
+@interface WeakOverride : Test
+@end
+
+@implementation WeakOverride
+- (id)retain
+{
+	retainCount++;
+	return self;
+}
+@end
+
+int main(void)
+{
+	// Allocate an instance before any message is sent to the class, so that
+	// the class is not initialised yet.  Its -retain must still be used, both
+	// for this object and for objects allocated after initialisation.
+	Class cls = objc_getClass("Override");
+	id obj = class_createInstance(cls, 0);
+	objc_retain(obj);
+	assert(1 == retainCount);
+	id other = class_createInstance(cls, 0);
+	objc_retain(other);
+	assert(2 == retainCount);
+	object_dispose(other);
+	object_dispose(obj);
+
+	// The same, when the first use of the class is a weak reference.
+	cls = objc_getClass("WeakOverride");
+	obj = class_createInstance(cls, 0);
+	id weak = nil;
+	objc_initWeak(&weak, obj);
+	objc_retain(obj);
+	assert(3 == retainCount);
+	objc_destroyWeak(&weak);
+	object_dispose(obj);
+	return 0;
+}
@@ -0,0 +1,94 @@
+#include "Test.h"
+#include <pthread.h>
+#include <stdio.h>
+
+#define MAX_READERS 8
+#define READS 200000
+
+struct Rect
+{
+	double x, y;
+};
+
+struct Box
+{
+	long a, b, c, d;
+};
+
+@interface Shape : Test
+{
+	struct Rect rect;
+	struct Box box;
+}
+@property (atomic) struct Rect rect;
+@property (atomic) struct Box box;
+@end
+
+@implementation Shape
+@synthesize rect;
+@synthesize box;
+@end
+
+static Shape *shape;
+static volatile int stop;
+
+static void *writer(void *arg)
+{
+	for (long i=0 ; !stop ; i++)
+	{
+		struct Rect r = { i, i };
+		shape.rect = r;
+		struct Box b = { i, i, i, i };
+		shape.box = b;
+	}
+	return NULL;
+}
+
+static void *reader(void *arg)
+{
+	for (int i=0 ; i<READS ; i++)
+	{
+		// Readers must never see a partially written structure.
+		struct Rect r = shape.rect;
+		assert(r.x == r.y);
+		struct Box b = shape.box;
+		assert((b.a == b.b) && (b.b == b.c) && (b.c == b.d));
+	}
+	return NULL;
+}
+
+static void run(int readers)
+{
+	pthread_t writerThread;
+	pthread_t threads[MAX_READERS];
+	stop = 0;
+	int writerError = pthread_create(&writerThread, NULL, writer, NULL);
+	assert(0 == writerError);
+	double start = now();
+	for (int i=0 ; i<readers ; i++)
+	{
+		int error = pthread_create(&threads[i], NULL, reader, NULL);
+		assert(0 == error);
+	}
+	for (int i=0 ; i<readers ; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+	double end = now();
+	stop = 1;
+	pthread_join(writerThread, NULL);
+	double ns = end - start;
+	fprintf(stderr, "%d readers, 1 writer: %.1f million structure reads per second\n",
+			readers, (2.0 * readers * READS) / (ns / 1e3));
+}
+
+int main(void)
+{
+	shape = [Shape new];
+	for (int readers=1 ; readers<=MAX_READERS ; readers*=2)
+	{
+		run(readers);
+	}
+	[shape release];
+	return 0;
+}
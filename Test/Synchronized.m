@@ -0,0 +1,92 @@
+#include "Test.h"
+#include <pthread.h>
+#include <stdio.h>
+
+#define THREADS 8
+#define ITERATIONS 100000
+
+int objc_sync_enter(id object);
+int objc_sync_exit(id object);
+
+static id shared;
+static long counter;
+
+static void *worker(void *arg)
+{
+	for (int i=0 ; i<ITERATIONS ; i++)
+	{
+		@synchronized(shared)
+		{
+			// Recursive locking must not deadlock.
+			@synchronized(shared)
+			{
+				counter++;
+			}
+		}
+	}
+	return NULL;
+}
+
+int main(void)
+{
+	shared = [Test new];
+	Class cls = *(Class*)shared;
+
+	// Exiting a monitor that is not held is an error.
+	assert(0 != objc_sync_exit(shared));
+
+	pthread_t threads[THREADS];
+	double start = now();
+	for (int i=0 ; i<THREADS ; i++)
+	{
+		int error = pthread_create(&threads[i], NULL, worker, NULL);
+		assert(0 == error);
+	}
+	for (int i=0 ; i<THREADS ; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+	double end = now();
+	assert(THREADS * ITERATIONS == counter);
+	// Locking an object must not give it a hidden class.
+	assert(*(Class*)shared == cls);
+	assert(nil == objc_getAssociatedObject(shared, &counter));
+
+	double ns = end - start;
+	fprintf(stderr, "%.1fns per contended @synchronized\n",
+			ns / (THREADS * ITERATIONS));
+
+	// Uncontended throughput on distinct objects.
+	id objects[64];
+	for (int i=0 ; i<64 ; i++)
+	{
+		objects[i] = [Test new];
+	}
+	start = now();
+	for (int i=0 ; i<ITERATIONS ; i++)
+	{
+		@synchronized(objects[i % 64]) {}
+	}
+	end = now();
+	ns = end - start;
+	fprintf(stderr, "%.1fns per uncontended @synchronized\n", ns / ITERATIONS);
+	// Holding several objects at once needs monitors as well as thin locks.
+	for (int i=0 ; i<64 ; i++)
+	{
+		@synchronized(objects[i])
+		{
+			@synchronized(objects[(i + 1) % 64])
+			{
+				@synchronized(objects[i]) {}
+			}
+		}
+		assert(0 != objc_sync_exit(objects[i]));
+	}
+	for (int i=0 ; i<64 ; i++)
+	{
+		assert(*(Class*)objects[i] == *(Class*)shared);
+		[objects[i] release];
+	}
+	[shared release];
+	return 0;
+}
@@ -4,11 +4,32 @@
 #undef NDEBUG
 #endif
 #include <assert.h>
+#include <time.h>
 
 #ifndef __has_attribute
 #define __has_attribute(x) 0
 #endif
 
+/**
+ * Returns a monotonic time in nanoseconds, for timing benchmarks.
+ */
+__attribute__((unused))
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * Returns the number of milliseconds since start, a time returned by now().
+ */
+__attribute__((unused))
+static double elapsed_ms(double start)
+{
+  return (now() - start) / 1e6;
+}
+
 #if __has_attribute(objc_root_class)
 __attribute__((objc_root_class))
 #endif
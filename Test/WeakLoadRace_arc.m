@@ -0,0 +1,86 @@
+#include "Test.h"
+#include <pthread.h>
+
+#define WRITERS 4
+#define READERS 16
+#define ITERATIONS 50000
+#define MAGIC 0x5ca1ab1e
+
+@interface Sentinel : Test
+{
+	@public
+	volatile int magic;
+}
+@end
+@implementation Sentinel
+- (void)dealloc
+{
+	magic = 0;
+}
+@end
+
+static __weak Sentinel *slots[WRITERS];
+static volatile int finished;
+
+static void *writer(void *arg)
+{
+	intptr_t slot = (intptr_t)arg;
+	for (int i=0 ; i<ITERATIONS ; i++)
+	{
+		@autoreleasepool {
+			Sentinel *s = [Sentinel new];
+			s->magic = MAGIC;
+			slots[slot] = s;
+		}
+		// The object is deallocated here, while readers may be loading it.
+	}
+	__sync_fetch_and_add(&finished, 1);
+	return NULL;
+}
+
+static void *reader(void *arg)
+{
+	intptr_t slot = (intptr_t)arg % WRITERS;
+	while (finished < WRITERS)
+	{
+		@autoreleasepool {
+			Sentinel *strong = slots[slot];
+			// If a weak load returns an object then it must not have been
+			// deallocated and must remain valid while we hold it.
+			if (nil != strong)
+			{
+				assert(MAGIC == strong->magic);
+			}
+		}
+	}
+	return NULL;
+}
+
+int main(void)
+{
+	pthread_t writers[WRITERS];
+	pthread_t readers[READERS];
+	for (intptr_t i=0 ; i<READERS ; i++)
+	{
+		int error = pthread_create(&readers[i], NULL, reader, (void*)i);
+		assert(0 == error);
+	}
+	for (intptr_t i=0 ; i<WRITERS ; i++)
+	{
+		int error = pthread_create(&writers[i], NULL, writer, (void*)i);
+		assert(0 == error);
+	}
+	for (int i=0 ; i<WRITERS ; i++)
+	{
+		pthread_join(writers[i], NULL);
+	}
+	for (int i=0 ; i<READERS ; i++)
+	{
+		pthread_join(readers[i], NULL);
+	}
+	for (int i=0 ; i<WRITERS ; i++)
+	{
+		assert(nil == slots[i]);
+	}
+	return 0;
+}
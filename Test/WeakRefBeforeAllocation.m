@@ -0,0 +1,51 @@
+#include "Test.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+static int deallocCount;
+/**
+ * An object allocated without class_createInstance(), as a custom allocator
+ * would, with room for the runtime's object header in front of it.
+ */
+static id early;
+
+@interface Early : Test
+@end
+
+@implementation Early
+- (void)dealloc
+{
+	deallocCount++;
+	if (self == early)
+	{
+		free(((uintptr_t*)self) - 2);
+		return;
+	}
+	[super dealloc];
+}
+@end
+
+int main(void)
+{
+	Class cls = objc_getClass("Early");
+	uintptr_t *memory =
+		calloc(1, 2 * sizeof(uintptr_t) + class_getInstanceSize(cls));
+	early = (id)(memory + 2);
+	*(Class*)early = cls;
+
+	// Take a weak reference before the runtime has decided whether Early
+	// uses fast ARC.  Storing it initialises the class, which decides.
+	id weak = nil;
+	objc_initWeak(&weak, early);
+
+	id obj = class_createInstance(cls, 0);
+	objc_release(obj);
+	assert(1 == deallocCount);
+
+	// Releasing the early object must clear its weak reference.
+	objc_release(early);
+	assert(2 == deallocCount);
+	assert(nil == weak);
+	assert(nil == objc_loadWeakRetained(&weak));
+	return 0;
+}
@@ -0,0 +1,64 @@
+#include "Test.h"
+#include <pthread.h>
+#include <stdio.h>
+
+#define THREADS 64
+#define SHARED 16
+#define ITERATIONS 20000
+
+static id shared[SHARED];
+
+static void *worker(void *arg)
+{
+	@autoreleasepool {
+		intptr_t seed = (intptr_t)arg;
+		id mine = [Test new];
+		__weak id ref = nil;
+		for (int i=0 ; i<ITERATIONS ; i++)
+		{
+			// Alternate between objects that are private to this thread and
+			// ones that every thread holds weak references to.
+			id expected = (i & 1) ? mine : shared[(seed + i) % SHARED];
+			ref = expected;
+			id strong = ref;
+			assert(strong == expected);
+		}
+		// Objects that are deallocated while weakly referenced must have their
+		// references zeroed.
+		for (int i=0 ; i<ITERATIONS / 100 ; i++)
+		{
+			id tmp = [Test new];
+			@autoreleasepool {
+				ref = tmp;
+				assert(ref == tmp);
+			}
+			tmp = nil;
+			assert(ref == nil);
+		}
+	}
+	return NULL;
+}
+
+int main(void)
+{
+	pthread_t threads[THREADS];
+
+	for (int i=0 ; i<SHARED ; i++)
+	{
+		shared[i] = [Test new];
+	}
+	double start = now();
+	for (intptr_t i=0 ; i<THREADS ; i++)
+	{
+		int error = pthread_create(&threads[i], NULL, worker, (void*)i);
+		assert(0 == error);
+	}
+	for (int i=0 ; i<THREADS ; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+	double ns = now() - start;
+	fprintf(stderr, "%d threads: %.1fns per weak store and load\n", THREADS,
+			ns / ((double)THREADS * ITERATIONS));
+	return 0;
+}
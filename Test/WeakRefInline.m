@@ -0,0 +1,63 @@
+#include "Test.h"
+#include <stdio.h>
+
+#define ITERATIONS 100000
+
+/**
+ * Loads a weak reference without leaving the object in an autorelease pool.
+ */
+static id load(id *weak)
+{
+	id obj = objc_loadWeakRetained(weak);
+	objc_release(obj);
+	return obj;
+}
+
+int main(void)
+{
+	id obj = [Test new];
+	id w1 = nil, w2 = nil, w3 = nil, moved = nil;
+
+	// A single weak reference.
+	objc_initWeak(&w1, obj);
+	assert(load(&w1) == obj);
+
+	// A second and third weak reference to the same object.
+	objc_initWeak(&w2, obj);
+	objc_initWeak(&w3, obj);
+	assert(load(&w2) == obj);
+	assert(load(&w3) == obj);
+
+	// Removing the first reference must leave the others intact, and a new
+	// reference may then reuse its storage.
+	objc_destroyWeak(&w1);
+	assert(nil == w1);
+	objc_initWeak(&w1, obj);
+
+	// Moving a reference must update the address that is zeroed.
+	objc_moveWeak(&moved, &w1);
+	assert(nil == w1);
+	assert(load(&moved) == obj);
+
+	// Deallocating the object zeroes every reference.
+	objc_release(obj);
+	assert(nil == load(&moved));
+	assert(nil == load(&w2));
+	assert(nil == load(&w3));
+	assert(nil == w1);
+
+	// Measure the common case: one weak reference to a short-lived object.
+	double start = now();
+	for (int i=0 ; i<ITERATIONS ; i++)
+	{
+		id tmp = [Test new];
+		id weak = nil;
+		objc_initWeak(&weak, tmp);
+		load(&weak);
+		objc_release(tmp);
+		assert(nil == weak);
+	}
+	fprintf(stderr, "%.1fns per object with one weak reference\n",
+			(now() - start) / ITERATIONS);
+	return 0;
+}
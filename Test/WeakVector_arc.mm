@@ -0,0 +1,55 @@
+#include "Test.h"
+#include <stdio.h>
+#include <vector>
+
+#define TARGETS 8
+#define ELEMENTS 4096
+#define ITERATIONS 100
+
+struct Observer
+{
+	__weak id target;
+	int index;
+};
+
+int main(void)
+{
+	double start = now();
+	for (int iteration=0 ; iteration<ITERATIONS ; iteration++)
+	{
+		@autoreleasepool
+		{
+			id targets[TARGETS];
+			for (int i=0 ; i<TARGETS ; i++)
+			{
+				targets[i] = [Test new];
+			}
+			// Growing the vector moves every element, so each of the targets
+			// has hundreds of weak references moved each time it reallocates.
+			std::vector<Observer> observers;
+			for (int i=0 ; i<ELEMENTS ; i++)
+			{
+				Observer o;
+				o.target = targets[i % TARGETS];
+				o.index = i;
+				observers.push_back(o);
+			}
+			for (int i=0 ; i<ELEMENTS ; i++)
+			{
+				assert(observers[i].index == i);
+				assert(observers[i].target == targets[i % TARGETS]);
+			}
+			for (int i=0 ; i<TARGETS ; i++)
+			{
+				targets[i] = nil;
+			}
+			for (int i=0 ; i<ELEMENTS ; i++)
+			{
+				assert(nil == observers[i].target);
+			}
+		}
+	}
+	fprintf(stderr, "%.1fns per vector element\n",
+			(now() - start) / ((double)ITERATIONS * ELEMENTS));
+	return 0;
+}
@@ -27,6 +27,7 @@
 #include "objc/runtime.h"
 #include "class.h"
 #include "lock.h"
+#include "loader.h"
 #include "string_hash.h"
 
 #include <stdlib.h>
@@ -122,5 +123,10 @@ BOOL class_registerAlias_np(Class class, const char *alias)
   }
   Alias newAlias = { strdup(alias), class };
   alias_table_insert(newAlias);
+  // Classes and categories may have been loaded before the alias that they
+  // refer to.
+  LOCK_RUNTIME_FOR_SCOPE();
+  objc_load_categories_for_class(class, alias);
+  objc_resolve_waiting_classes(alias);
   return 1;
 }
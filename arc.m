@@ -5,6 +5,7 @@
 #import "objc/blocks_runtime.h"
 #import "nsobject.h"
 #import "class.h"
+#import "refcount.h"
 #import "selector.h"
 #import "visibility.h"
 #import "objc/hooks.h"
@@ -157,6 +158,10 @@ static IMP NewAutoreleasePool;
 static IMP DeleteAutoreleasePool;
 static IMP AutoreleaseAdd;
 
+void checkARCAccessors(Class cls);
+void objc_send_initialize(id object);
+BOOL is_initialised(Class class);
+
 extern BOOL FastARCRetain;
 extern BOOL FastARCRelease;
 extern BOOL FastARCAutorelease;
@@ -174,14 +179,8 @@ static inline id retain(id obj)
 	}
 	if (objc_test_class_flag(cls, objc_class_flag_fast_arc))
 	{
-		intptr_t *refCount = ((intptr_t*)obj) - 1;
-		// Note: this should be an atomic read, so that a sufficiently clever
-		// compiler doesn't notice that there's no happens-before relationship
-		// here.
-		if (*refCount >= 0)
-		{
-			__sync_add_and_fetch(refCount, 1);
-		}
+		// Objects that are being deallocated are not resurrected.
+		refcount_increment(refcount_for_object(obj));
 		return obj;
 	}
 	return [obj retain];
@@ -203,12 +202,16 @@ static inline void release(id obj)
 	}
 	if (objc_test_class_flag(cls, objc_class_flag_fast_arc))
 	{
-		intptr_t *refCount = ((intptr_t*)obj) - 1;
-		// We allow refcounts to run into the negative, but should only
-		// deallocate once.
-		if (__sync_sub_and_fetch(refCount, 1) == -1)
+		uintptr_t flags;
+		if (refcount_decrement(refcount_for_object(obj), &flags))
 		{
-			objc_delete_weak_refs(obj);
+			// Objects that have never been weakly referenced have nothing in
+			// the weak reference table and can not be seen by lock-free weak
+			// loads, so we can skip the weak reference table lock.
+			if (flags & refcount_weakly_referenced)
+			{
+				objc_delete_weak_refs(obj);
+			}
 			[obj dealloc];
 		}
 		return;
@@ -369,6 +372,33 @@ void objc_autoreleasePoolPop(void *pool)
 	}
 }
 
+#ifndef ENABLE_GC
+void *objc_region_begin(void *pool);
+void *objc_region_pool(void *region);
+void objc_region_end(void *region);
+#endif
+
+void *objc_region_push(void)
+{
+	void *pool = objc_autoreleasePoolPush();
+#ifdef ENABLE_GC
+	return pool;
+#else
+	return objc_region_begin(pool);
+#endif
+}
+
+void objc_region_pop(void *region)
+{
+#ifdef ENABLE_GC
+	objc_autoreleasePoolPop(region);
+#else
+	// Deallocate the region's objects before reclaiming their memory.
+	objc_autoreleasePoolPop(objc_region_pool(region));
+	objc_region_end(region);
+#endif
+}
+
 id objc_autorelease(id obj)
 {
 	if (nil != obj)
@@ -469,11 +499,24 @@ id objc_storeStrong(id *addr, id value)
 
 typedef struct objc_weak_ref
 {
+	/** The weakly referenced object. */
 	id obj;
-	id *ref[4];
-	struct objc_weak_ref *next;
+	/** The number of weak references in refs. */
+	uint32_t count;
+	/** The number of elements in refs.  Always zero or a power of two. */
+	uint32_t capacity;
+	/**
+	 * Open-addressed set of the addresses of weak references to obj, using
+	 * linear probing.  Empty elements are NULL.
+	 */
+	id **refs;
 } WeakRef;
 
+/**
+ * Initial capacity of the referrer set in a weak reference table entry.
+ */
+#define WEAK_REF_INITIAL_CAPACITY 4
+
 
 static int weak_ref_compare(const id obj, const WeakRef weak_ref)
 {
@@ -486,6 +529,95 @@ static uint32_t ptr_hash(const void *ptr)
 	// always be 0, which is not so useful for a hash value
 	return ((uintptr_t)ptr >> 4) | ((uintptr_t)ptr << ((sizeof(id) * 8) - 4));
 }
+/**
+ * Returns the preferred position of addr in the referrer set.
+ */
+static inline uint32_t referrerIndex(WeakRef *ref, id *addr)
+{
+	uint32_t hash = ptr_hash(addr) * 2654435761U;
+	return hash >> (32 - __builtin_ctz(ref->capacity));
+}
+
+static void referrerInsert(WeakRef *ref, id *addr);
+
+static void referrerGrow(WeakRef *ref)
+{
+	id **old = ref->refs;
+	uint32_t oldCapacity = ref->capacity;
+	ref->capacity = (0 == oldCapacity) ? WEAK_REF_INITIAL_CAPACITY
+	                                   : oldCapacity * 2;
+	ref->refs = calloc(ref->capacity, sizeof(id*));
+	ref->count = 0;
+	for (uint32_t i=0 ; i<oldCapacity ; i++)
+	{
+		if (NULL != old[i])
+		{
+			referrerInsert(ref, old[i]);
+		}
+	}
+	free(old);
+}
+
+/**
+ * Adds addr to the set of weak references to an object.
+ */
+static void referrerInsert(WeakRef *ref, id *addr)
+{
+	// Keep the load factor below 3/4 so that probe sequences stay short and
+	// there is always an empty element to terminate them.
+	if ((ref->count + 1) * 4 > ref->capacity * 3)
+	{
+		referrerGrow(ref);
+	}
+	uint32_t mask = ref->capacity - 1;
+	for (uint32_t i=referrerIndex(ref, addr) ; ; i = (i + 1) & mask)
+	{
+		if (NULL == ref->refs[i])
+		{
+			ref->refs[i] = addr;
+			ref->count++;
+			return;
+		}
+	}
+}
+
+/**
+ * Removes addr from the set of weak references to an object.  Returns NO if
+ * addr was not in the set.
+ */
+static BOOL referrerRemove(WeakRef *ref, id *addr)
+{
+	if (0 == ref->count)
+	{
+		return NO;
+	}
+	id **refs = ref->refs;
+	uint32_t mask = ref->capacity - 1;
+	uint32_t gap = referrerIndex(ref, addr);
+	while (refs[gap] != addr)
+	{
+		if (NULL == refs[gap])
+		{
+			return NO;
+		}
+		gap = (gap + 1) & mask;
+	}
+	// Shift later elements of the same probe sequence back into the gap, so
+	// that lookups never need to skip over deleted elements.
+	for (uint32_t i=(gap + 1) & mask ; NULL != refs[i] ; i = (i + 1) & mask)
+	{
+		uint32_t home = referrerIndex(ref, refs[i]);
+		if (((i - home) & mask) >= ((i - gap) & mask))
+		{
+			refs[gap] = refs[i];
+			gap = i;
+		}
+	}
+	refs[gap] = NULL;
+	ref->count--;
+	return YES;
+}
+
 static int weak_ref_hash(const WeakRef weak_ref)
 {
 	return ptr_hash(weak_ref.obj);
@@ -507,14 +639,219 @@ const static WeakRef NullWeakRef;
 #define MAP_TABLE_NO_LOCK 1
 
 #include "hash_table.h"
+#include "epoch.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Reference count overflow
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * The part of a fast-ARC object's reference count that does not fit in the
+ * object header.
+ */
+struct refcount_overflow_entry
+{
+	uintptr_t *refCount;
+	uintptr_t count;
+};
+
+static int refcount_overflow_compare(const uintptr_t *refCount,
+                                     const struct refcount_overflow_entry e)
+{
+	return refCount == e.refCount;
+}
+static int refcount_overflow_hash(const struct refcount_overflow_entry e)
+{
+	return ptr_hash(e.refCount);
+}
+static int refcount_overflow_is_null(const struct refcount_overflow_entry e)
+{
+	return e.refCount == NULL;
+}
+const static struct refcount_overflow_entry NullOverflowEntry;
+#define MAP_TABLE_NAME refcount_overflow
+#define MAP_TABLE_COMPARE_FUNCTION refcount_overflow_compare
+#define MAP_TABLE_HASH_KEY ptr_hash
+#define MAP_TABLE_HASH_VALUE refcount_overflow_hash
+#define MAP_TABLE_VALUE_TYPE struct refcount_overflow_entry
+#define MAP_TABLE_VALUE_NULL refcount_overflow_is_null
+#define MAP_TABLE_VALUE_PLACEHOLDER NullOverflowEntry
+#define MAP_TABLE_ACCESS_BY_REFERENCE 1
+#define MAP_TABLE_SINGLE_THREAD 1
+#define MAP_TABLE_NO_LOCK 1
+
+#include "hash_table.h"
+
+/**
+ * Side table for reference counts that overflow the header, and the lock
+ * that protects it.  Only the slow paths in refcount.h use these.
+ */
+static refcount_overflow_table *overflowTable;
+static mutex_t overflowLock;
+
+/**
+ * The amount that is moved between the count field and the side table.
+ */
+static const uintptr_t refcount_overflow_half = (refcount_mask >> 1) + 1;
+
+PRIVATE BOOL refcount_overflow_increment(uintptr_t *refCount)
+{
+	LOCK_FOR_SCOPE(&overflowLock);
+	uintptr_t count = *refCount;
+	for (;;)
+	{
+		if (refcount_is_deallocating(count))
+		{
+			return NO;
+		}
+		// Another thread may have released a reference since the caller
+		// looked, in which case there is room in the header again.
+		BOOL isFull = ((count & refcount_mask) == refcount_mask);
+		uintptr_t newCount = isFull ?
+			((count - refcount_overflow_half + 1) | refcount_overflow) :
+			count + 1;
+		uintptr_t old = __sync_val_compare_and_swap(refCount, count, newCount);
+		if (old == count)
+		{
+			if (isFull)
+			{
+				struct refcount_overflow_entry *e =
+					refcount_overflow_table_get(overflowTable, refCount);
+				if (NULL == e)
+				{
+					struct refcount_overflow_entry newEntry =
+						{ refCount, refcount_overflow_half };
+					refcount_overflow_insert(overflowTable, newEntry);
+				}
+				else
+				{
+					e->count += refcount_overflow_half;
+				}
+			}
+			return YES;
+		}
+		count = old;
+	}
+}
+
+PRIVATE BOOL refcount_overflow_decrement(uintptr_t *refCount)
+{
+	LOCK_FOR_SCOPE(&overflowLock);
+	uintptr_t count = *refCount;
+	for (;;)
+	{
+		if (refcount_is_deallocating(count))
+		{
+			return NO;
+		}
+		uintptr_t newCount;
+		uintptr_t borrow = 0;
+		struct refcount_overflow_entry *e = NULL;
+		if ((0 != (count & refcount_mask)) || !(count & refcount_overflow))
+		{
+			// Another thread changed the count since the caller looked, so
+			// this is an ordinary decrement.
+			newCount = (0 == (count & refcount_mask)) ?
+				(count | refcount_deallocating) : count - 1;
+		}
+		else
+		{
+			// Move up to half of the range back from the side table.
+			e = refcount_overflow_table_get(overflowTable, refCount);
+			if (NULL != e)
+			{
+				borrow = (e->count < refcount_overflow_half) ?
+					e->count : refcount_overflow_half;
+			}
+			newCount = (0 == borrow) ?
+				((count & ~refcount_overflow) | refcount_deallocating) :
+				count + borrow - 1;
+			if ((NULL != e) && (borrow == e->count))
+			{
+				newCount &= ~refcount_overflow;
+			}
+		}
+		uintptr_t old = __sync_val_compare_and_swap(refCount, count, newCount);
+		if (old == count)
+		{
+			if (0 != borrow)
+			{
+				e->count -= borrow;
+				if (0 == e->count)
+				{
+					refcount_overflow_remove(overflowTable, refCount);
+				}
+			}
+			return refcount_is_deallocating(newCount);
+		}
+		count = old;
+	}
+}
 
-static weak_ref_table *weakRefs;
-mutex_t weakRefLock;
+unsigned long object_getRetainCount_np(id obj)
+{
+	if (isSmallObject(obj) ||
+	    !objc_test_class_flag(classForObject(obj), objc_class_flag_fast_arc))
+	{
+		return 0;
+	}
+	uintptr_t *refCount = refcount_for_object(obj);
+	uintptr_t count = __sync_fetch_and_add(refCount, 0);
+	unsigned long total = (count & refcount_mask) + 1;
+	if (count & refcount_overflow)
+	{
+		LOCK_FOR_SCOPE(&overflowLock);
+		count = *refCount;
+		total = (count & refcount_mask) + 1;
+		struct refcount_overflow_entry *e =
+			refcount_overflow_table_get(overflowTable, refCount);
+		if (NULL != e)
+		{
+			total += e->count;
+		}
+	}
+	return total;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Weak reference table shards
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Number of shards in the weak reference table.  Must be a power of two.
+ */
+#define WEAK_REF_SHARD_BITS 6
+#define WEAK_REF_SHARDS (1<<WEAK_REF_SHARD_BITS)
+
+/**
+ * A shard of the weak reference table.  Each object's weak references live in
+ * exactly one shard, selected by the object's address, and are protected by
+ * that shard's lock.  Shards are padded to a cache line so that threads
+ * working on unrelated objects do not contend on the same line.
+ */
+struct weak_ref_shard
+{
+	mutex_t lock;
+	weak_ref_table *table;
+	/**
+	 * Readers that are loading weak references to objects in this shard
+	 * without holding the lock.  Objects are not freed until these readers
+	 * have finished.
+	 */
+	struct epoch readers;
+} __attribute__((aligned(64)));
+
+static struct weak_ref_shard weakRefShards[WEAK_REF_SHARDS];
 
 PRIVATE void init_arc(void)
 {
-	weak_ref_initialize(&weakRefs, 128);
-	INIT_LOCK(weakRefLock);
+	for (int i=0 ; i<WEAK_REF_SHARDS ; i++)
+	{
+		weak_ref_initialize(&weakRefShards[i].table, 16);
+		INIT_LOCK(weakRefShards[i].lock);
+	}
+	refcount_overflow_initialize(&overflowTable, 16);
+	INIT_LOCK(overflowLock);
 #ifndef NO_PTHREADS
 	pthread_key_create(&ARCThreadKey, (void(*)(void*))cleanupPools);
 #endif
@@ -522,6 +859,142 @@ PRIVATE void init_arc(void)
 
 void* block_load_weak(void *block);
 
+/**
+ * Returns the shard that holds the weak references to obj.  The table inside
+ * the shard indexes by the low bits of ptr_hash(), so the shard is chosen from
+ * the high bits of a multiplicative mix of the same hash to keep the two
+ * independent.
+ */
+static inline struct weak_ref_shard *shardForObject(id obj)
+{
+	uint32_t hash = ptr_hash(obj) * 2654435761U;
+	return &weakRefShards[hash >> (32 - WEAK_REF_SHARD_BITS)];
+}
+
+/**
+ * A pair of shard locks held for the duration of a scope.
+ */
+struct weak_ref_shard_pair
+{
+	struct weak_ref_shard *first;
+	struct weak_ref_shard *second;
+};
+
+/**
+ * Locks the shards for two objects.  Either may be NULL.  Shards are always
+ * acquired in address order so that two threads moving weak references in
+ * opposite directions can not deadlock.
+ */
+static inline struct weak_ref_shard_pair
+lockShardPair(struct weak_ref_shard *a, struct weak_ref_shard *b)
+{
+	if (a == b) { b = NULL; }
+	if ((NULL == a) || ((NULL != b) && (b < a)))
+	{
+		struct weak_ref_shard *tmp = a;
+		a = b;
+		b = tmp;
+	}
+	if (NULL != a) { LOCK(&a->lock); }
+	if (NULL != b) { LOCK(&b->lock); }
+	return (struct weak_ref_shard_pair){ a, b };
+}
+
+static inline void unlockShardPair(struct weak_ref_shard_pair *pair)
+{
+	if (NULL != pair->second) { UNLOCK(&pair->second->lock); }
+	if (NULL != pair->first) { UNLOCK(&pair->first->lock); }
+}
+
+#define LOCK_SHARDS_FOR_SCOPE(a, b) \
+	__attribute__((cleanup(unlockShardPair)))\
+	__attribute__((unused)) struct weak_ref_shard_pair shard_pair_pointer = lockShardPair(a, b)
+
+/**
+ * Locks the shard that contains the object that *addr refers to and returns
+ * that object.  The value at addr is checked again once the lock is held,
+ * because the shard is selected by the object and another thread may have
+ * changed the weak reference (or zeroed it) in the meantime.  Returns nil
+ * without acquiring any lock if the reference is nil or a small object.
+ */
+static inline id lockShardForWeakRef(id *addr, struct weak_ref_shard **shard)
+{
+	*shard = NULL;
+	for (;;)
+	{
+		id obj = *addr;
+		if ((nil == obj) || isSmallObject(obj))
+		{
+			return obj;
+		}
+		struct weak_ref_shard *s = shardForObject(obj);
+		LOCK(&s->lock);
+		if (*addr == obj)
+		{
+			*shard = s;
+			return obj;
+		}
+		UNLOCK(&s->lock);
+	}
+}
+
+static inline void unlockShard(struct weak_ref_shard **shard)
+{
+	if (NULL != *shard) { UNLOCK(&(*shard)->lock); }
+}
+
+/**
+ * Returns whether obj has an inline weak reference slot.  Only fast-ARC
+ * objects have a reference count word that we can inspect.
+ */
+static inline BOOL hasWeakSlot(id obj)
+{
+	return !isSmallObject(obj) &&
+	       objc_test_class_flag(classForObject(obj), objc_class_flag_fast_arc) &&
+	       (*refcount_for_object(obj) & refcount_weak_slot);
+}
+
+/**
+ * Removes addr from the inline weak reference slot of obj.  Returns NO if obj
+ * does not have an inline slot or if addr is not stored there.  The caller
+ * must hold the object's shard lock.
+ */
+static inline BOOL removeWeakSlot(id obj, id *addr)
+{
+	if (!hasWeakSlot(obj))
+	{
+		return NO;
+	}
+	id **slot = weak_slot_for_object(obj);
+	if (*slot != addr)
+	{
+		return NO;
+	}
+	*slot = NULL;
+	return YES;
+}
+
+/**
+ * Stores addr in the inline weak reference slot of a fast-ARC object.
+ * Returns NO if the object has no inline slot or if it is already in use, in
+ * which case the reference must go in the weak reference table.  The caller
+ * must hold the object's shard lock.
+ */
+static inline BOOL addWeakSlot(id obj, uintptr_t refCount, id *addr)
+{
+	if (!(refCount & refcount_weak_slot))
+	{
+		return NO;
+	}
+	id **slot = weak_slot_for_object(obj);
+	if (NULL != *slot)
+	{
+		return NO;
+	}
+	*slot = addr;
+	return YES;
+}
+
 id objc_storeWeak(id *addr, id obj)
 {
 	id old = *addr;
@@ -537,32 +1010,40 @@ id objc_storeWeak(id *addr, id obj)
 		{
 			isGlobalObject = YES;
 		}
+		else if (cls != &_NSConcreteMallocBlock)
+		{
+			// The object may have been created before the runtime decided
+			// whether its class uses fast ARC, which it does when the class
+			// is initialised.  Decide now, because release only clears weak
+			// references to fast-ARC objects that have
+			// refcount_weakly_referenced set.
+			if (!is_initialised(cls))
+			{
+				objc_send_initialize(obj);
+			}
+			checkARCAccessors(cls);
+		}
 	}
 	if (cls && objc_test_class_flag(cls, objc_class_flag_fast_arc))
 	{
-		intptr_t *refCount = ((intptr_t*)obj) - 1;
-		if (obj && *refCount < 0)
+		if (refcount_is_deallocating(*refcount_for_object(obj)))
 		{
 			obj = nil;
 			cls = Nil;
 		}
 	}
-	LOCK_FOR_SCOPE(&weakRefLock);
-	if (nil != old)
+	struct weak_ref_shard *oldShard = (nil == old) ? NULL : shardForObject(old);
+	struct weak_ref_shard *newShard =
+		(isGlobalObject || (nil == obj)) ? NULL : shardForObject(obj);
+	LOCK_SHARDS_FOR_SCOPE(oldShard, newShard);
+	// If the old object was deallocated while we were waiting for the lock,
+	// then its weak references, including this one, have been zeroed.
+	if ((nil != old) && (*addr == old) && !removeWeakSlot(old, addr))
 	{
-		WeakRef *oldRef = weak_ref_table_get(weakRefs, old);
-		while (NULL != oldRef)
+		WeakRef *oldRef = weak_ref_table_get(oldShard->table, old);
+		if (NULL != oldRef)
 		{
-			for (int i=0 ; i<4 ; i++)
-			{
-				if (oldRef->ref[i] == addr)
-				{
-					oldRef->ref[i] = 0;
-					oldRef = 0;
-					break;
-				}
-			}
-			oldRef = (oldRef == NULL) ? NULL : oldRef->next;
+			referrerRemove(oldRef, addr);
 		}
 	}
 	if (nil == obj)
@@ -583,10 +1064,17 @@ id objc_storeWeak(id *addr, id obj)
 	}
 	else if (objc_test_class_flag(cls, objc_class_flag_fast_arc))
 	{
-		if ((*(((intptr_t*)obj) - 1)) < 0)
+		uintptr_t *refCount = refcount_for_object(obj);
+		if (!refcount_set_flag(refCount, refcount_weakly_referenced))
 		{
+			*addr = nil;
 			return nil;
 		}
+		if (addWeakSlot(obj, *refCount, addr))
+		{
+			*addr = obj;
+			return obj;
+		}
 	}
 	else
 	{
@@ -594,77 +1082,123 @@ id objc_storeWeak(id *addr, id obj)
 	}
 	if (nil != obj)
 	{
-		WeakRef *ref = weak_ref_table_get(weakRefs, obj);
-		while (NULL != ref)
-		{
-			for (int i=0 ; i<4 ; i++)
-			{
-				if (0 == ref->ref[i])
-				{
-					ref->ref[i] = addr;
-					*addr = obj;
-					return obj;
-				}
-			}
-			if (ref->next == NULL)
-			{
-				break;
-			}
-			ref = ref->next;
-		}
+		WeakRef *ref = weak_ref_table_get(newShard->table, obj);
 		if (NULL != ref)
 		{
-			ref->next = calloc(sizeof(WeakRef), 1);
-			ref->next->ref[0] = addr;
+			referrerInsert(ref, addr);
 		}
 		else
 		{
 			WeakRef newRef = {0};
 			newRef.obj = obj;
-			newRef.ref[0] = addr;
-			weak_ref_insert(weakRefs, newRef);
+			referrerInsert(&newRef, addr);
+			weak_ref_insert(newShard->table, newRef);
 		}
 	}
 	*addr = obj;
 	return obj;
 }
 
-static void zeroRefs(WeakRef *ref, BOOL shouldFree)
+static void zeroRefs(WeakRef *ref)
 {
-	if (NULL != ref->next)
+	for (uint32_t i=0 ; i<ref->capacity ; i++)
 	{
-		zeroRefs(ref->next, YES);
+		if (NULL != ref->refs[i])
+		{
+			*ref->refs[i] = nil;
+		}
 	}
-	for (int i=0 ; i<4 ; i++)
+	free(ref->refs);
+}
+
+void objc_delete_weak_refs(id obj)
+{
+	struct weak_ref_shard *shard = shardForObject(obj);
+	LOCK_FOR_SCOPE(&shard->lock);
+	if (hasWeakSlot(obj))
 	{
-		if (0 != ref->ref[i])
+		id **slot = weak_slot_for_object(obj);
+		if (NULL != *slot)
 		{
-			*ref->ref[i] = 0;
+			**slot = nil;
+			*slot = NULL;
 		}
 	}
-	if (shouldFree)
+	WeakRef *oldRef = weak_ref_table_get(shard->table, obj);
+	if (0 != oldRef)
 	{
-		free(ref);
+		zeroRefs(oldRef);
+		weak_ref_remove(shard->table, obj);
 	}
+	// A lock-free reader may have loaded a pointer to this object before we
+	// zeroed the weak references (or before objc_storeWeak() replaced them), so
+	// wait for them before the object is freed.
+	epoch_synchronize(&shard->readers);
 }
 
-void objc_delete_weak_refs(id obj)
+/**
+ * Retains a fast-ARC object, unless it has already started deallocating.
+ * Returns the object, or nil if it is being deallocated.
+ */
+static inline id retainIfLive(id obj)
 {
-	LOCK_FOR_SCOPE(&weakRefLock);
-	WeakRef *oldRef = weak_ref_table_get(weakRefs, obj);
-	if (0 != oldRef)
+	return refcount_increment(refcount_for_object(obj)) ? obj : nil;
+}
+
+/**
+ * Loads a weak reference to a fast-ARC object without acquiring the shard
+ * lock.  Sets *isFastARC to NO and returns nil if the object must be loaded
+ * with the lock held instead.
+ */
+static inline id loadWeakRetainedFastARC(id *addr, BOOL *isFastARC)
+{
+	*isFastARC = YES;
+	for (;;)
 	{
-		zeroRefs(oldRef, NO);
-		weak_ref_remove(weakRefs, obj);
+		id obj = *(id volatile*)addr;
+		if (nil == obj) { return nil; }
+		// Small objects don't need reference count modification
+		if (isSmallObject(obj))
+		{
+			return obj;
+		}
+		struct weak_ref_shard *shard = shardForObject(obj);
+		uintptr_t epoch = epoch_enter(&shard->readers);
+		// Once we are registered as a reader, the object can not be freed
+		// until we leave, as long as the weak reference still points to it.
+		if (*(id volatile*)addr != obj)
+		{
+			epoch_exit(&shard->readers, epoch);
+			continue;
+		}
+		Class cls = classForObject(obj);
+		if (objc_test_class_flag(cls, objc_class_flag_fast_arc))
+		{
+			obj = retainIfLive(obj);
+		}
+		else
+		{
+			*isFastARC = NO;
+			obj = nil;
+		}
+		epoch_exit(&shard->readers, epoch);
+		return obj;
 	}
 }
 
 id objc_loadWeakRetained(id* addr)
 {
-	LOCK_FOR_SCOPE(&weakRefLock);
-	id obj = *addr;
+	BOOL isFastARC;
+	id obj = loadWeakRetainedFastARC(addr, &isFastARC);
+	if (isFastARC)
+	{
+		return obj;
+	}
+	// Blocks and objects that manage their own reference counts must be loaded
+	// with the lock held.
+	__attribute__((cleanup(unlockShard))) struct weak_ref_shard *shard;
+	obj = lockShardForWeakRef(addr, &shard);
 	if (nil == obj) { return nil; }
-	// Small objects don't need reference count modification
 	if (isSmallObject(obj))
 	{
 		return obj;
@@ -676,10 +1210,7 @@ id objc_loadWeakRetained(id* addr)
 	}
 	else if (objc_test_class_flag(cls, objc_class_flag_fast_arc))
 	{
-		if ((*(((intptr_t*)obj) - 1)) < 0)
-		{
-			return nil;
-		}
+		return retainIfLive(obj);
 	}
 	else
 	{
@@ -700,23 +1231,23 @@ void objc_copyWeak(id *dest, id *src)
 
 void objc_moveWeak(id *dest, id *src)
 {
-	// Don't retain or release.  While the weak ref lock is held, we know that
-	// the object can't be deallocated, so we just move the value and update
-	// the weak reference table entry to indicate the new address.
-	LOCK_FOR_SCOPE(&weakRefLock);
+	// Don't retain or release.  While the object's shard lock is held, we know
+	// that the object can't be deallocated, so we just move the value and
+	// update the weak reference table entry to indicate the new address.
+	__attribute__((cleanup(unlockShard))) struct weak_ref_shard *shard;
+	lockShardForWeakRef(src, &shard);
 	*dest = *src;
 	*src = nil;
-	WeakRef *oldRef = weak_ref_table_get(weakRefs, *dest);
-	while (NULL != oldRef)
+	if (NULL == shard) { return; }
+	if (removeWeakSlot(*dest, src))
 	{
-		for (int i=0 ; i<4 ; i++)
-		{
-			if (oldRef->ref[i] == src)
-			{
-				oldRef->ref[i] = dest;
-				return;
-			}
-		}
+		*weak_slot_for_object(*dest) = dest;
+		return;
+	}
+	WeakRef *oldRef = weak_ref_table_get(shard->table, *dest);
+	if ((NULL != oldRef) && referrerRemove(oldRef, src))
+	{
+		referrerInsert(oldRef, dest);
 	}
 }
 
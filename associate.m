@@ -11,6 +11,7 @@
 #include "selector.h"
 #include "lock.h"
 #include "gc_ops.h"
+#include "refcount.h"
 
 /**
  * A single associative reference.  Contains the key, value, and association
@@ -34,34 +35,46 @@ struct reference
 	uintptr_t policy;
 };
 
-#define REFERENCE_LIST_SIZE 10
-
 /**
- * Linked list of references associated with an object.  We assume that there
- * won't be very many, so we don't bother with a proper hash table, and just
- * iterate over a list.
+ * Open-addressed hash table of references.  Keys are never removed from a
+ * table once they have been inserted, so readers can probe it without taking
+ * a lock.  When the table fills up, it is replaced by a larger copy.  Readers
+ * register in the epoch of the list's lock stripe, and a table that has been
+ * replaced or removed is freed once none of them can still be looking at it.
  */
-struct reference_list
+struct reference_table
 {
 	/**
-	 * Next group of references.  This is only ever used if we have more than
-	 * 10 references associated with an object, which seems highly unlikely.
+	 * Number of slots in the table.  Always a power of two.
 	 */
-	struct reference_list *next;
+	uint32_t capacity;
 	/**
-	 * Mutex.  Only set for the first reference list in a chain.  Used for
-	 * @syncronize().
+	 * Number of slots with a key set.
 	 */
-	mutex_t lock;
+	uint32_t count;
+	/**
+	 * Array of references.
+	 */
+	struct reference list[];
+};
+
+#define REFERENCE_TABLE_INITIAL_CAPACITY 8
+
+/**
+ * References associated with an object.
+ */
+struct reference_list
+{
+	/**
+	 * The current reference table, or NULL if no references have been set.
+	 * Modified only while holding the lock for this list.
+	 */
+	struct reference_table *volatile table;
 	/**
 	 * Garbage collection type.  This stores the location of all of the
 	 * instance variables in the object that may contain pointers.
 	 */
 	void *gc_type;
-	/**
-	 * Array of references.
-	 */
-	struct reference list[REFERENCE_LIST_SIZE];
 };
 enum
 {
@@ -73,51 +86,151 @@ static BOOL isAtomic(uintptr_t policy)
 	return (policy & OBJC_ASSOCIATION_ATOMIC) == OBJC_ASSOCIATION_ATOMIC;
 }
 
-static struct reference* findReference(struct reference_list *list, void *key)
+static inline uint32_t referenceHash(void *key)
 {
-	if (NULL == list) { return NULL; }
+	// Keys are usually the addresses of static variables, so the low bits are
+	// mostly zero.
+	uintptr_t k = (uintptr_t)key;
+	return (uint32_t)((k >> 3) ^ (k >> 11) ^ (k >> 19));
+}
 
-	for (int i=0 ; i<REFERENCE_LIST_SIZE ; i++)
+/**
+ * Returns the slot for key in the table, or NULL if it is not present.  Safe
+ * to call without holding the lock.
+ */
+static struct reference* findReference(struct reference_table *table, void *key)
+{
+	if (NULL == table) { return NULL; }
+
+	uint32_t mask = table->capacity - 1;
+	for (uint32_t i=referenceHash(key) ; ; i++)
 	{
-		if (list->list[i].key == key)
-		{
-			return &list->list[i];
-		}
+		struct reference *r = &table->list[i & mask];
+		// The acquire pairs with the barrier in insertReference(), so we see
+		// the value that was stored before the key.
+		void *k = __atomic_load_n(&r->key, __ATOMIC_ACQUIRE);
+		if (k == key) { return r; }
+		if (0 == k) { return NULL; }
 	}
-	return NULL;
 }
-static void cleanupReferenceList(struct reference_list *list)
+
+static struct reference_table *allocateReferenceTable(uint32_t capacity)
 {
-	if (NULL == list) { return; }
+	struct reference_table *table =
+		gc->malloc(sizeof(struct reference_table) +
+		           capacity * sizeof(struct reference));
+	table->capacity = capacity;
+	return table;
+}
+
+/**
+ * Inserts a key that is not yet in the table.  The object and policy are
+ * stored before the key is published.
+ */
+static struct reference* insertReference(struct reference_table *table,
+                                         void *key,
+                                         void *obj,
+                                         uintptr_t policy)
+{
+	uint32_t mask = table->capacity - 1;
+	uint32_t i = referenceHash(key);
+	while (0 != table->list[i & mask].key) { i++; }
+	struct reference *r = &table->list[i & mask];
+	r->object = obj;
+	r->policy = policy;
+	__sync_synchronize();
+	r->key = key;
+	table->count++;
+	return r;
+}
 
-	cleanupReferenceList(list->next);
+/**
+ * Waits until no reader can still be looking at a table that is no longer
+ * reachable from the list, and then frees it.  Must be called with the list
+ * locked.
+ */
+static void freeUnreachableTable(struct reference_list *list,
+                                 struct reference_table *table)
+{
+	epoch_synchronize(&stripe_for_pointer(list)->readers);
+	gc->free(table);
+}
 
-	for (int i=0 ; i<REFERENCE_LIST_SIZE ; i++)
+static void freeReferenceList(struct reference_list *list)
+{
+	if (NULL != list->table)
 	{
-		struct reference *r = &list->list[i];
+		gc->free(list->table);
+	}
+}
+
+/**
+ * Returns a table for the list with space for one more key.  Must be called
+ * with the list locked.
+ */
+static struct reference_table *reserveReference(struct reference_list *list)
+{
+	struct reference_table *old = list->table;
+	if (NULL == old)
+	{
+		struct reference_table *table =
+			allocateReferenceTable(REFERENCE_TABLE_INITIAL_CAPACITY);
+		__sync_synchronize();
+		list->table = table;
+		return table;
+	}
+	// Keep the load factor below 3/4
+	if ((old->count + 1) * 4 <= old->capacity * 3)
+	{
+		return old;
+	}
+	struct reference_table *table = allocateReferenceTable(old->capacity * 2);
+	for (uint32_t i=0 ; i<old->capacity ; i++)
+	{
+		struct reference *r = &old->list[i];
 		if (0 != r->key)
 		{
-			r->key = 0;
-			if (OBJC_ASSOCIATION_ASSIGN != r->policy)
-			{
-				// Full barrier - ensure that we've zero'd the key before doing
-				// this!
-				__sync_synchronize();
-				objc_release(r->object);
-			}
-			r->object = 0;
-			r->policy = 0;
+			insertReference(table, r->key, r->object, r->policy);
 		}
 	}
+	// Make sure the copy is complete before readers can see it.
+	__sync_synchronize();
+	list->table = table;
+	freeUnreachableTable(list, old);
+	return table;
 }
 
-static void freeReferenceList(struct reference_list *l)
+static void releaseReferences(struct reference_table *table)
 {
-	if (NULL == l) { return; }
-	freeReferenceList(l->next);
-	gc->free(l);
+	if (NULL == table) { return; }
+
+	for (uint32_t i=0 ; i<table->capacity ; i++)
+	{
+		struct reference *r = &table->list[i];
+		if ((0 != r->key) && (OBJC_ASSOCIATION_ASSIGN != r->policy))
+		{
+			objc_release(r->object);
+		}
+	}
 }
 
+static void cleanupReferenceList(struct reference_list *list)
+{
+	if (NULL == list) { return; }
+
+	volatile int *lock = lock_for_pointer(list);
+	lock_spinlock(lock);
+	struct reference_table *table = list->table;
+	list->table = NULL;
+	unlock_spinlock(lock);
+	if (NULL == table) { return; }
+	releaseReferences(table);
+	// Readers may still be probing the table, so wait for them before freeing
+	// it.  Writers to the epoch must hold the lock.
+	lock_spinlock(lock);
+	freeUnreachableTable(list, table);
+	unlock_spinlock(lock);
+}
 static void setReference(struct reference_list *list,
                          void *key,
                          void *obj,
@@ -137,61 +250,74 @@ static void setReference(struct reference_list *list,
 		case OBJC_ASSOCIATION_ASSIGN:
 			break;
 	}
-	// While inserting into the list, we need to lock it temporarily.
+	// All modifications happen with the list locked, so that they can't be
+	// lost when the table is copied.  Atomic getters also take this lock.
 	volatile int *lock = lock_for_pointer(list);
 	lock_spinlock(lock);
-	struct reference *r = findReference(list, key);
+	struct reference *r = findReference(list->table, key);
 	// If there's an existing reference, then we can update it, otherwise we
 	// have to install a new one
 	if (NULL == r)
 	{
-		// Search for an unused slot
-		r = findReference(list, 0);
-		if (NULL == r)
-		{
-			struct reference_list *l = list;
-
-			while (NULL != l->next) { l = l->next; }
-
-			l->next = gc->malloc(sizeof(struct reference_list));
-			r = &l->next->list[0];
-		}
-		r->key = key;
-	}
-	unlock_spinlock(lock);
-	// Now we only need to lock if the old or new property is atomic
-	BOOL needLock = isAtomic(r->policy) || isAtomic(policy);
-	if (needLock)
-	{
-		lock = lock_for_pointer(r);
-		lock_spinlock(lock);
+		insertReference(reserveReference(list), key, obj, policy);
+		unlock_spinlock(lock);
+		return;
 	}
-	r->policy = policy;
+	uintptr_t oldPolicy = r->policy;
 	id old = r->object;
 	r->object = obj;
-	if (OBJC_ASSOCIATION_ASSIGN != r->policy)
+	r->policy = policy;
+	unlock_spinlock(lock);
+	if (OBJC_ASSOCIATION_ASSIGN != oldPolicy)
 	{
 		objc_release(old);
 	}
-	if (needLock)
-	{
-		unlock_spinlock(lock);
-	}
 }
 
-static void deallocHiddenClass(id obj, SEL _cmd);
+/**
+ * Returns the value of an atomic reference, retained and autoreleased.
+ */
+static id getAtomicReference(struct reference_list *list, void *key)
+{
+	volatile int *lock = lock_for_pointer(list);
+	lock_spinlock(lock);
+	// The table may have been replaced since we looked, so look again with
+	// the lock held.
+	struct reference *r = findReference(list->table, key);
+	id obj = (NULL == r) ? nil : objc_retain(r->object);
+	unlock_spinlock(lock);
+	return objc_autorelease(obj);
+}
 
 static inline Class findHiddenClass(id obj)
 {
 	Class cls = obj->isa;
+	// Fast-ARC objects record in their header whether they have ever been
+	// given a hidden class, so we can skip walking the class hierarchy.
+	if (objc_test_class_flag(cls, objc_class_flag_fast_arc) &&
+	    !(*refcount_for_object(obj) & refcount_has_assoc))
+	{
+		return Nil;
+	}
 	while (Nil != cls &&
 	       !objc_test_class_flag(cls, objc_class_flag_assoc_class))
 	{
+		// Classes above a clone's shared overlay belong to its prototype.
+		if (objc_test_class_flag(cls, objc_class_flag_shared_overlay))
+		{
+			return Nil;
+		}
 		cls = class_getSuperclass(cls);
 	}
 	return cls;
 }
 
+/**
+ * Allocates a hidden class.  Hidden classes belong to a single object and are
+ * freed with it, so they are not linked into their superclass's subclass list
+ * and are not registered with the runtime, and creating one does not need the
+ * runtime lock.
+ */
 static Class allocateHiddenClass(Class superclass)
 {
 	Class newClass =
@@ -210,13 +336,16 @@ static Class allocateHiddenClass(Class superclass)
 		objc_class_flag_class | objc_class_flag_user_created |
 		objc_class_flag_new_abi | objc_class_flag_hidden_class |
 		objc_class_flag_assoc_class;
+	// The hidden class has no methods of its own yet, so it has the same
+	// retain and release methods as its superclass.
+	if (objc_test_class_flag(superclass, objc_class_flag_fast_arc))
+	{
+		objc_set_class_flag(newClass, objc_class_flag_fast_arc);
+	}
 	newClass->super_class = superclass;
 	newClass->dtable = NULL;
 	newClass->instance_size = superclass->instance_size;
-
-	LOCK_RUNTIME_FOR_SCOPE();
-	newClass->sibling_class = superclass->subclass_list;
-	superclass->subclass_list = newClass;
+	install_hidden_class_dtable(newClass);
 
 	return newClass;
 }
@@ -225,51 +354,241 @@ static inline Class initHiddenClassForObject(id obj)
 {
 	Class hiddenClass = allocateHiddenClass(obj->isa);
 	assert(!class_isMetaClass(obj->isa));
-	static SEL cxx_destruct;
-	if (NULL == cxx_destruct)
+	// Set the flag before installing the hidden class, so that anything that
+	// sees the hidden class also sees the flag.
+	if (objc_test_class_flag(obj->isa, objc_class_flag_fast_arc))
 	{
-		cxx_destruct = sel_registerName(".cxx_destruct");
+		__sync_fetch_and_or(refcount_for_object(obj), refcount_has_assoc);
 	}
-	const char *types = sizeof(void*) == 4 ? "v8@0:4" : "v16@0:8";
-	class_addMethod(hiddenClass, cxx_destruct,
-		(IMP)deallocHiddenClass, types);
 	obj->isa = hiddenClass;
 	return hiddenClass;
 }
 
-static void deallocHiddenClass(id obj, SEL _cmd)
+/**
+ * Allocates the overlay class shared by clones of a prototype, which has the
+ * given hidden class.  The overlay has no methods of its own.  Clones that
+ * have methods added, or that are given associated objects, get a hidden
+ * class of their own whose superclass is the overlay.
+ *
+ * Unlike hidden classes, overlays are shared by many objects and so are
+ * added to the selector caches.
+ */
+static Class allocateOverlayClass(Class hiddenClass, id prototype)
 {
-	LOCK_RUNTIME_FOR_SCOPE();
-	Class hiddenClass = findHiddenClass(obj);
-	// After calling [super dealloc], the object will no longer exist.
-	// Free the hidden class.
-	struct reference_list *list = object_getIndexedIvars(hiddenClass);
-	DESTROY_LOCK(&list->lock);
-	cleanupReferenceList(list);
-	freeReferenceList(list->next);
-	remove_class(hiddenClass);
-	// We shouldn't have any subclasses left at this point
-	assert(hiddenClass->subclass_list == 0);
-	// Remove the class from the subclass list of its superclass
-	Class sub = hiddenClass->super_class->subclass_list;
-	if (sub == hiddenClass)
+	Class newClass = calloc(1, sizeof(struct objc_class) + sizeof(id));
+
+	if (Nil == newClass) { return Nil; }
+
+	newClass->isa = hiddenClass->isa;
+	newClass->name = hiddenClass->name;
+	newClass->info = objc_class_flag_resolved |
+		objc_class_flag_class | objc_class_flag_user_created |
+		objc_class_flag_new_abi | objc_class_flag_shared_overlay;
+	if (objc_test_class_flag(hiddenClass, objc_class_flag_fast_arc))
 	{
-		hiddenClass->super_class->subclass_list = hiddenClass->sibling_class;
+		objc_set_class_flag(newClass, objc_class_flag_fast_arc);
 	}
-	else
+	newClass->super_class = hiddenClass;
+	newClass->dtable = NULL;
+	newClass->instance_size = hiddenClass->instance_size;
+	// The overlay does not retain the prototype: the prototype owns the
+	// overlay, and each clone retains the prototype.
+	*(id*)object_getIndexedIvars(newClass) = prototype;
+	install_hidden_class_dtable(newClass);
+
+	return newClass;
+}
+
+/**
+ * Returns the prototype of a clone, or nil if the object is not a clone.
+ */
+static inline id prototypeForObject(id object)
+{
+	Class cls = object->isa;
+	if (objc_test_class_flag(cls, objc_class_flag_hidden_class))
 	{
-		while (sub != NULL)
+		cls = cls->super_class;
+	}
+	if (objc_test_class_flag(cls, objc_class_flag_shared_overlay))
+	{
+		return *(id*)object_getIndexedIvars(cls);
+	}
+	return nil;
+}
+
+PRIVATE void free_hidden_class(id obj)
+{
+	Class cls = obj->isa;
+	if (objc_test_class_flag(cls, objc_class_flag_hidden_class))
+	{
+		Class hiddenClass = cls;
+		struct reference_list *list = object_getIndexedIvars(hiddenClass);
+		cleanupReferenceList(list);
+		freeReferenceList(list);
+		// The overlay for clones of this object, if it has been used as a
+		// prototype.  All clones have been destroyed, because they retain
+		// their prototype.
+		Class overlay = hiddenClass->subclass_list;
+		// Only classes that have had methods added with object_addMethod_np()
+		// and overlays have anything in the dispatch tables or caches.
+		if ((NULL != hiddenClass->methods) || (Nil != overlay))
 		{
-			if ((Class)sub->sibling_class == hiddenClass)
+			LOCK_RUNTIME_FOR_SCOPE();
+			if (Nil != overlay)
 			{
-				sub->sibling_class = hiddenClass->sibling_class;
-				break;
+				remove_class(overlay);
+				free(overlay);
 			}
-			sub = sub->sibling_class;
+			remove_class(hiddenClass);
 		}
+		cls = obj->isa = hiddenClass->super_class;
+		free(hiddenClass);
+	}
+	if (objc_test_class_flag(cls, objc_class_flag_shared_overlay))
+	{
+		objc_release(*(id*)object_getIndexedIvars(cls));
+	}
+}
+
+#ifdef ASSOCIATION_SIDE_TABLE
+/**
+ * Entry in the association side table, mapping an object to its references.
+ */
+struct association
+{
+	id object;
+	struct reference_list *list;
+};
+
+static uint32_t association_ptr_hash(const void *ptr)
+{
+	// Bit-rotate right 4, since the lowest few bits in an object pointer will
+	// always be 0, which is not so useful for a hash value
+	return ((uintptr_t)ptr >> 4) | ((uintptr_t)ptr << ((sizeof(id) * 8) - 4));
+}
+static int association_compare(const id obj, const struct association a)
+{
+	return obj == a.object;
+}
+static int association_hash(const struct association a)
+{
+	return association_ptr_hash(a.object);
+}
+static int association_is_null(const struct association a)
+{
+	return a.object == NULL;
+}
+const static struct association NullAssociation;
+#define MAP_TABLE_NAME association
+#define MAP_TABLE_COMPARE_FUNCTION association_compare
+#define MAP_TABLE_HASH_KEY association_ptr_hash
+#define MAP_TABLE_HASH_VALUE association_hash
+#define MAP_TABLE_VALUE_TYPE struct association
+#define MAP_TABLE_VALUE_NULL association_is_null
+#define MAP_TABLE_VALUE_PLACEHOLDER NullAssociation
+#define MAP_TABLE_ACCESS_BY_REFERENCE 1
+#define MAP_TABLE_SINGLE_THREAD 1
+#define MAP_TABLE_NO_LOCK 1
+
+#include "hash_table.h"
+
+#define ASSOCIATION_SHARD_BITS 6
+#define ASSOCIATION_SHARDS (1<<ASSOCIATION_SHARD_BITS)
+
+/**
+ * A shard of the association side table.  Objects are assigned to shards by
+ * address, so threads adding associations to unrelated objects rarely contend.
+ */
+struct association_shard
+{
+	mutex_t lock;
+	association_table *table;
+} __attribute__((aligned(64)));
+
+static struct association_shard associationShards[ASSOCIATION_SHARDS];
+
+/**
+ * Number of objects that have ever been given a side-table entry.  While this
+ * is zero, destroying objects whose class does not use the fast ARC path does
+ * not need to look in the side table.
+ */
+static volatile int associationCount;
+
+static inline struct association_shard *shardForAssociation(id obj)
+{
+	uint32_t hash = association_ptr_hash(obj) * 2654435761U;
+	return &associationShards[hash >> (32 - ASSOCIATION_SHARD_BITS)];
+}
+
+/**
+ * Returns YES if obj has definitely never been given a side-table entry.
+ * Fast-ARC objects record this in their header.
+ */
+static inline BOOL hasNoSideTableEntry(id obj)
+{
+	if (objc_test_class_flag(obj->isa, objc_class_flag_fast_arc))
+	{
+		return !(*refcount_for_object(obj) & refcount_has_assoc);
 	}
-	// Free the class
-	free(hiddenClass);
+	return 0 == associationCount;
+}
+
+static struct reference_list* sideTableListForObject(id object, BOOL create)
+{
+	if (!create && hasNoSideTableEntry(object)) { return NULL; }
+	struct association_shard *shard = shardForAssociation(object);
+	LOCK_FOR_SCOPE(&shard->lock);
+	struct association *a = association_table_get(shard->table, object);
+	if (NULL != a)
+	{
+		return a->list;
+	}
+	if (!create) { return NULL; }
+	struct reference_list *list = gc->malloc(sizeof(struct reference_list));
+	association_insert(shard->table, (struct association){ object, list });
+	if (objc_test_class_flag(object->isa, objc_class_flag_fast_arc))
+	{
+		__sync_fetch_and_or(refcount_for_object(object), refcount_has_assoc);
+	}
+	else
+	{
+		__sync_fetch_and_add(&associationCount, 1);
+	}
+	return list;
+}
+
+PRIVATE void free_side_table_associations(id obj)
+{
+	if (hasNoSideTableEntry(obj)) { return; }
+	struct association_shard *shard = shardForAssociation(obj);
+	struct reference_list *list = NULL;
+	{
+		LOCK_FOR_SCOPE(&shard->lock);
+		struct association *a = association_table_get(shard->table, obj);
+		if (NULL != a)
+		{
+			list = a->list;
+			association_remove(shard->table, obj);
+		}
+	}
+	if (NULL == list) { return; }
+	// The object is being destroyed, so nothing else can be using its
+	// references any more.
+	cleanupReferenceList(list);
+	freeReferenceList(list);
+	gc->free(list);
+}
+#endif
+
+PRIVATE void init_associations(void)
+{
+#ifdef ASSOCIATION_SIDE_TABLE
+	for (int i=0 ; i<ASSOCIATION_SHARDS ; i++)
+	{
+		association_initialize(&associationShards[i].table, 16);
+		INIT_LOCK(associationShards[i].lock);
+	}
+#endif
 }
 
 static struct reference_list* referenceListForObject(id object, BOOL create)
@@ -284,7 +603,6 @@ static struct reference_list* referenceListForObject(id object, BOOL create)
 			lock_spinlock(lock);
 			if (NULL == cls->extra_data)
 			{
-				INIT_LOCK(list->lock);
 				cls->extra_data = list;
 				unlock_spinlock(lock);
 			}
@@ -296,6 +614,9 @@ static struct reference_list* referenceListForObject(id object, BOOL create)
 		}
 		return cls->extra_data;
 	}
+#ifdef ASSOCIATION_SIDE_TABLE
+	return sideTableListForObject(object, create);
+#else
 	Class hiddenClass = findHiddenClass(object);
 	if ((NULL == hiddenClass) && create)
 	{
@@ -305,12 +626,11 @@ static struct reference_list* referenceListForObject(id object, BOOL create)
 		if (NULL == hiddenClass)
 		{
 			hiddenClass = initHiddenClassForObject(object);
-			struct reference_list *list = object_getIndexedIvars(hiddenClass);
-			INIT_LOCK(list->lock);
 		}
 		unlock_spinlock(lock);
 	}
 	return hiddenClass ? object_getIndexedIvars(hiddenClass) : NULL;
+#endif
 }
 
 void objc_setAssociatedObject(id object,
@@ -327,38 +647,30 @@ id objc_getAssociatedObject(id object, void *key)
 {
 	if (isSmallObject(object)) { return nil; }
 	struct reference_list *list = referenceListForObject(object, NO);
-	if (NULL == list) { return nil; }
-	struct reference *r = findReference(list, key);
-	if (NULL != r)
+	if (NULL != list)
 	{
-		return r->object;
+		// The table can not be freed while we are registered in the epoch.
+		struct epoch *readers = &stripe_for_pointer(list)->readers;
+		uintptr_t epoch = epoch_enter(readers);
+		struct reference *r = findReference(list->table, key);
+		if (NULL != r)
+		{
+			BOOL atomic = isAtomic(r->policy);
+			id obj = r->object;
+			epoch_exit(readers, epoch);
+			return atomic ? getAtomicReference(list, key) : obj;
+		}
+		epoch_exit(readers, epoch);
 	}
 	if (class_isMetaClass(object->isa))
 	{
 		return nil;
 	}
-	Class cls = object->isa;
-	while (Nil != cls)
+	// Clones inherit the associations of their prototype.
+	id prototype = prototypeForObject(object);
+	if (nil != prototype)
 	{
-		while (Nil != cls &&
-			   !objc_test_class_flag(cls, objc_class_flag_assoc_class))
-		{
-			cls = class_getSuperclass(cls);
-		}
-		if (Nil != cls)
-		{
-			struct reference_list *next_list = object_getIndexedIvars(cls);
-			if (list != next_list)
-			{
-				list = next_list;
-				struct reference *r = findReference(list, key);
-				if (NULL != r)
-				{
-					return r->object;
-				}
-			}
-			cls = class_getSuperclass(cls);
-		}
+		return objc_getAssociatedObject(prototype, key);
 	}
 	return nil;
 }
@@ -381,26 +693,6 @@ PRIVATE void gc_setTypeForClass(Class cls, void *type)
 	list->gc_type = type;
 }
 
-int objc_sync_enter(id object)
-{
-	if ((object == 0) || isSmallObject(object)) { return 0; }
-	struct reference_list *list = referenceListForObject(object, YES);
-	LOCK(&list->lock);
-	return 0;
-}
-
-int objc_sync_exit(id object)
-{
-	if ((object == 0) || isSmallObject(object)) { return 0; }
-	struct reference_list *list = referenceListForObject(object, NO);
-	if (NULL != list)
-	{
-		UNLOCK(&list->lock);
-		return 0;
-	}
-	return 1;
-}
-
 static Class hiddenClassForObject(id object)
 {
 	if (isSmallObject(object)) { return nil; }
@@ -417,8 +709,6 @@ static Class hiddenClassForObject(id object)
 		if (NULL == hiddenClass)
 		{
 			hiddenClass = initHiddenClassForObject(object);
-			struct reference_list *list = object_getIndexedIvars(hiddenClass);
-			INIT_LOCK(list->lock);
 		}
 		unlock_spinlock(lock);
 	}
@@ -434,24 +724,32 @@ IMP object_replaceMethod_np(id object, SEL name, IMP imp, const char *types)
 {
 	return class_replaceMethod(hiddenClassForObject(object), name, imp, types);
 }
-static char prototypeKey;
-
 id object_clone_np(id object)
 {
 	if (isSmallObject(object)) { return object; }
+	assert(!class_isMetaClass(object->isa));
 	// Make sure that the prototype has a hidden class, so that methods added
 	// to it will appear in the clone.
-	referenceListForObject(object, YES);
-	id new = class_createInstance(object->isa, 0);
-	Class hiddenClass = initHiddenClassForObject(new);
-	struct reference_list *list = object_getIndexedIvars(hiddenClass);
-	INIT_LOCK(list->lock);
-	objc_setAssociatedObject(new, &prototypeKey, object,
-			OBJC_ASSOCIATION_RETAIN_NONATOMIC);
-	return new;
+	Class hiddenClass = hiddenClassForObject(object);
+	Class overlay = hiddenClass->subclass_list;
+	if (Nil == overlay)
+	{
+		volatile int *lock = lock_for_pointer(hiddenClass);
+		lock_spinlock(lock);
+		overlay = hiddenClass->subclass_list;
+		if (Nil == overlay)
+		{
+			overlay = allocateOverlayClass(hiddenClass, object);
+			hiddenClass->subclass_list = overlay;
+		}
+		unlock_spinlock(lock);
+	}
+	objc_retain(object);
+	return class_createInstance(overlay, 0);
 }
 
 id object_getPrototype_np(id object)
 {
-	return objc_getAssociatedObject(object, &prototypeKey);
+	if (isSmallObject(object)) { return nil; }
+	return prototypeForObject(object);
 }
@@ -1,11 +1,46 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include "objc/runtime.h"
 #include "visibility.h"
 #include "loader.h"
 #include "dtable.h"
+#include "string_hash.h"
 
-#define BUFFER_TYPE struct objc_category
-#include "buffer.h"
+/**
+ * A category whose class has not been loaded yet.
+ */
+struct pending_category
+{
+  struct objc_category *cat;
+  /**
+   * The next category on the same class, in the order in which they were
+   * loaded.
+   */
+  struct pending_category *next;
+};
+
+static int pending_category_compare(const char *name,
+                                    const struct pending_category *pending)
+{
+  return string_compare(name, pending->cat->class_name);
+}
+static int pending_category_hash(const struct pending_category *pending)
+{
+  return string_hash(pending->cat->class_name);
+}
+#define MAP_TABLE_NAME pending_category
+#define MAP_TABLE_COMPARE_FUNCTION pending_category_compare
+#define MAP_TABLE_HASH_KEY string_hash
+#define MAP_TABLE_HASH_VALUE pending_category_hash
+#define MAP_TABLE_NO_LOCK
+#include "hash_table.h"
+
+/**
+ * Categories whose classes have not been loaded, indexed by class name.  Each
+ * entry is the first category loaded for that class.  Only accessed with the
+ * runtime lock held.
+ */
+static pending_category_table *pending_categories;
 
 void objc_send_load_message(Class class);
 
@@ -60,32 +95,51 @@ static BOOL try_load_category(struct objc_category *cat)
  */
 PRIVATE void objc_try_load_category(struct objc_category *cat)
 {
-  if (!try_load_category(cat))
+  if (try_load_category(cat))
   {
-    set_buffered_object_at_index(cat, buffered_objects++);
+    return;
   }
+  if (NULL == pending_categories)
+  {
+    pending_category_initialize(&pending_categories, 32);
+  }
+  struct pending_category *pending = malloc(sizeof(struct pending_category));
+  pending->cat = cat;
+  pending->next = NULL;
+  struct pending_category *head =
+    pending_category_table_get(pending_categories, cat->class_name);
+  if (NULL == head)
+  {
+    pending_category_insert(pending_categories, pending);
+    return;
+  }
+  // Categories are attached in the order in which they were loaded.
+  while (NULL != head->next)
+  {
+    head = head->next;
+  }
+  head->next = pending;
 }
 
-PRIVATE void objc_load_buffered_categories(void)
+PRIVATE void objc_load_categories_for_class(Class cls, const char *name)
 {
-  BOOL shouldReshuffle = NO;
-
-  for (unsigned i=0 ; i<buffered_objects ; i++)
+  if (NULL == pending_categories)
   {
-    struct objc_category *c = buffered_object_at_index(i);
-    if (NULL != c)
-    {
-      if (try_load_category(c))
-      {
-        set_buffered_object_at_index(NULL, i);
-        shouldReshuffle = YES;
-      }
-    }
+    return;
   }
-
-  if (shouldReshuffle)
+  struct pending_category *pending =
+    pending_category_table_get(pending_categories, name);
+  if (NULL == pending)
+  {
+    return;
+  }
+  pending_category_remove(pending_categories, (void*)name);
+  while (NULL != pending)
   {
-    compact_buffer();
+    struct pending_category *next = pending->next;
+    load_category(pending->cat, cls);
+    free(pending);
+    pending = next;
   }
 }
 
@@ -238,7 +238,43 @@ enum objc_class_flags
   /**
    * This class is a hidden class used to store associated values.
    */
-  objc_class_flag_assoc_class = (1<<8)
+  objc_class_flag_assoc_class = (1<<8),
+  /**
+   * This class is shared by all clones of a prototype object that have not
+   * been given their own hidden class.  Its superclass is the prototype's
+   * hidden class.  Like hidden classes, it is not registered in the class
+   * table and is not returned from object_getClass().
+   */
+  objc_class_flag_shared_overlay = (1<<9),
+  /**
+   * The methods of this class have not been added to the per-selector
+   * dispatch tables.  They are added for each selector the first time that a
+   * lookup for that selector reaches this class.
+   */
+  objc_class_flag_lazy_dtable = (1<<10),
+  /**
+   * This class could not be resolved because its superclass has not been
+   * loaded.  It is no longer in the list of unresolved classes, but is
+   * resolved when a class with its superclass's name is.
+   */
+  objc_class_flag_waiting_for_superclass = (1<<11),
+  /**
+   * objc_class_flag_fast_arc is up to date.  Cleared when a retain, release
+   * or autorelease method is added to or replaced in this class or one of its
+   * superclasses.
+   */
+  objc_class_flag_arc_checked = (1<<12),
+  /**
+   * objc_class_flag_has_cxx_methods is up to date.  Cleared when a
+   * .cxx_construct or .cxx_destruct method is added to or replaced in this
+   * class or one of its superclasses.
+   */
+  objc_class_flag_cxx_checked = (1<<13),
+  /**
+   * Instances of this class have C++ constructors or destructors to call,
+   * which are cached in a table in dtable.c.
+   */
+  objc_class_flag_has_cxx_methods = (1<<14)
 };
 
 /**
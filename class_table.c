@@ -15,6 +15,8 @@
 void objc_register_selectors_from_class(Class class);
 void objc_init_protocols(struct objc_protocol_list *protos);
 void objc_compute_ivar_offsets(Class class);
+BOOL objc_resolve_class(Class cls);
+void objc_load_categories_for_class(Class cls, const char *name);
 
 ////////////////////////////////////////////////////////////////////////////////
 // +load method hash table
@@ -91,10 +93,54 @@ static class_table_internal_table *class_table;
 #define unresolved_class_next subclass_list
 #define unresolved_class_prev sibling_class
 /**
- * Linked list using the subclass_list pointer in unresolved classes.
+ * Linked list using the subclass_list pointer in unresolved classes.  This
+ * contains the classes that have been loaded but not yet resolved.  Classes
+ * whose superclass is missing are moved to waiting_classes.
  */
 static Class unresolved_class_list;
 
+/**
+ * A class that is waiting for its superclass to be loaded.
+ */
+struct waiting_class
+{
+  /**
+   * The name of the missing superclass.
+   */
+  const char *super_name;
+  /**
+   * The waiting class.  This may have been resolved by some other route since
+   * it was added.
+   */
+  Class cls;
+  /**
+   * The next class waiting for the same superclass.
+   */
+  struct waiting_class *next;
+};
+
+static int waiting_class_compare(const char *name,
+                                 const struct waiting_class *waiting)
+{
+  return string_compare(name, waiting->super_name);
+}
+static int waiting_class_hash(const struct waiting_class *waiting)
+{
+  return string_hash(waiting->super_name);
+}
+#define MAP_TABLE_NAME waiting_class
+#define MAP_TABLE_COMPARE_FUNCTION waiting_class_compare
+#define MAP_TABLE_HASH_KEY string_hash
+#define MAP_TABLE_HASH_VALUE waiting_class_hash
+#include "hash_table.h"
+
+/**
+ * Classes whose superclass has not been loaded, indexed by the name of the
+ * superclass.  Each entry is the head of a list of the classes waiting for
+ * that superclass.
+ */
+static waiting_class_table *waiting_classes;
+
 static enum objc_developer_mode_np mode;
 
 void objc_setDeveloperMode_np(enum objc_developer_mode_np newMode)
@@ -141,6 +187,7 @@ PRIVATE Class class_table_next(void **e)
 PRIVATE void init_class_tables(void)
 {
   class_table_internal_initialize(&class_table, 4096);
+  waiting_class_initialize(&waiting_classes, 64);
   objc_init_load_messages_table();
 }
 
@@ -148,28 +195,18 @@ PRIVATE void init_class_tables(void)
 // Loader functions
 ////////////////////////////////////////////////////////////////////////////////
 
-PRIVATE BOOL objc_resolve_class(Class cls)
+/**
+ * Removes a class from the list of unresolved classes.  Classes that are
+ * waiting for their superclass are not in the list.  They are left in the
+ * waiting class table, which skips them once they are resolved.
+ */
+static void remove_unresolved_class(Class cls)
 {
-  // Skip this if the class is already resolved.
-  if (objc_test_class_flag(cls, objc_class_flag_resolved)) { return YES; }
-
-  // We can only resolve the class if its superclass is resolved.
-  if (cls->super_class)
+  if (objc_test_class_flag(cls, objc_class_flag_waiting_for_superclass))
   {
-    Class super = (Class)objc_getClass((char*)cls->super_class);
-    if (Nil == super) { return NO; }
-
-    if (!objc_test_class_flag(super, objc_class_flag_resolved))
-    {
-      if (!objc_resolve_class(super))
-      {
-        return NO;
-      }
-    }
+    objc_clear_class_flag(cls, objc_class_flag_waiting_for_superclass);
+    return;
   }
-
-
-  // Remove the class from the unresolved class list
   if (Nil == cls->unresolved_class_prev)
   {
     unresolved_class_list = cls->unresolved_class_next;
@@ -186,6 +223,80 @@ PRIVATE BOOL objc_resolve_class(Class cls)
   }
   cls->unresolved_class_prev = Nil;
   cls->unresolved_class_next = Nil;
+}
+
+/**
+ * Moves a class whose superclass could not be found from the list of
+ * unresolved classes to waiting_classes, so that later calls to
+ * objc_resolve_class_links() do not look for its superclass again.
+ */
+static void wait_for_superclass(Class cls)
+{
+  remove_unresolved_class(cls);
+  objc_set_class_flag(cls, objc_class_flag_waiting_for_superclass);
+  struct waiting_class *waiting = malloc(sizeof(struct waiting_class));
+  waiting->super_name = (char*)cls->super_class;
+  waiting->cls = cls;
+  waiting->next = NULL;
+  struct waiting_class *head =
+    waiting_class_table_get(waiting_classes, waiting->super_name);
+  if (NULL == head)
+  {
+    waiting_class_insert(waiting_classes, waiting);
+  }
+  else
+  {
+    waiting->next = head->next;
+    head->next = waiting;
+  }
+}
+
+PRIVATE void objc_resolve_waiting_classes(const char *name)
+{
+  struct waiting_class *waiting =
+    waiting_class_table_get(waiting_classes, name);
+  if (NULL == waiting) { return; }
+  LOCK_RUNTIME_FOR_SCOPE();
+  waiting = waiting_class_table_get(waiting_classes, name);
+  if (NULL == waiting) { return; }
+  waiting_class_remove(waiting_classes, (void*)name);
+  while (NULL != waiting)
+  {
+    struct waiting_class *next = waiting->next;
+    if (!objc_resolve_class(waiting->cls))
+    {
+      wait_for_superclass(waiting->cls);
+    }
+    free(waiting);
+    waiting = next;
+  }
+}
+
+PRIVATE BOOL objc_resolve_class(Class cls)
+{
+  // Skip this if the class is already resolved.
+  if (objc_test_class_flag(cls, objc_class_flag_resolved)) { return YES; }
+
+  // We can only resolve the class if its superclass is resolved.
+  Class super = Nil;
+  if (cls->super_class)
+  {
+    super = (Class)objc_getClass((char*)cls->super_class);
+    if (Nil == super) { return NO; }
+
+    if (!objc_test_class_flag(super, objc_class_flag_resolved))
+    {
+      if (!objc_resolve_class(super))
+      {
+        return NO;
+      }
+      // Resolving the superclass resolves the classes that were waiting for
+      // it, which may include this one.
+      if (objc_test_class_flag(cls, objc_class_flag_resolved)) { return YES; }
+    }
+  }
+
+  remove_unresolved_class(cls);
 
   // The superclass for the metaclass.  This is the metaclass for the
   // superclass if one exists, otherwise it is the root class itself
@@ -203,12 +314,6 @@ PRIVATE BOOL objc_resolve_class(Class cls)
   }
   else
   {
-    // Resolve the superclass if it isn't already resolved
-    Class super = (Class)objc_getClass((char*)cls->super_class);
-    if (!objc_test_class_flag(super, objc_class_flag_resolved))
-    {
-      objc_resolve_class(super);
-    }
     superMeta = super->isa;
     // Set the superclass pointer for the class and the superclass
     cls->super_class = super;
@@ -252,29 +357,35 @@ PRIVATE BOOL objc_resolve_class(Class cls)
   {
     _objc_load_callback(cls, 0);
   }
+#ifdef PREINITIALIZE_CLASSES
+  // Classes created at run time often have methods, including +initialize,
+  // added after they are registered.  Loaded classes are only recorded here
+  // and are queued once the load has finished.
+  if (!objc_test_class_flag(cls, objc_class_flag_user_created))
+  {
+    objc_preinitialize_class(cls);
+  }
+#endif
+  // Resolve any subclasses that were loaded first.
+  objc_resolve_waiting_classes(cls->name);
   return YES;
 }
 
 PRIVATE void objc_resolve_class_links(void)
 {
   LOCK_RUNTIME_FOR_SCOPE();
-  Class class = unresolved_class_list;
-  BOOL resolvedClass;
-  do
+  // Resolving a class resolves its superclasses first and then any classes
+  // that were waiting for it, so each class is visited once.  Every class
+  // leaves the list, either by being resolved or by being moved to the
+  // waiting class table.
+  Class class;
+  while (Nil != (class = unresolved_class_list))
   {
-    resolvedClass = NO;
-    while ((Nil != class))
+    if (!objc_resolve_class(class))
     {
-      Class next = class->unresolved_class_next;
-      objc_resolve_class(class);
-      if (resolvedClass ||
-        objc_test_class_flag(class, objc_class_flag_resolved))
-      {
-        resolvedClass = YES;
-      }
-      class = next;
+      wait_for_superclass(class);
     }
-  } while (resolvedClass);
+  }
 }
 void __objc_resolve_class_links(void)
 {
@@ -427,6 +538,9 @@ PRIVATE void objc_load_class(struct objc_class *class)
   {
     objc_init_protocols(class->protocols);
   }
+
+  // Attach any categories that were loaded before the class.
+  objc_load_categories_for_class(class, class->name);
 }
 
 PRIVATE Class SmallObjectClasses[7];
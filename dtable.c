@@ -26,7 +26,18 @@ _Static_assert(__builtin_offsetof(struct objc_slot, method) == SLOT_OFFSET,
     "Incorrect slot offset for assembly");
 
 
-PRIVATE mutex_t initialize_lock;
+/**
+ * Lock protecting modifications to the dtables.  No other locks, except the
+ * selector table lock, are acquired while holding it, so it can be used
+ * from message lookups without risking deadlock.
+ */
+static mutex_t dtable_lock;
+
+/**
+ * Bit that is set in the dtable field of a class while it is being
+ * initialised.  The remaining bits hold the class ID.
+ */
+#define DTABLE_INITIALIZING ((uintptr_t)1 << (sizeof(uintptr_t) * 8 - 1))
 
 struct objc_slot *objc_get_slot(Class cls, SEL selector);
 void objc_resolve_class(Class);
@@ -46,6 +57,47 @@ __attribute__((unused)) static void objc_release_object_lock(id *x)
     __attribute__((unused)) id lock_object_pointer = obj;\
     objc_sync_enter(obj);
 
+/**
+ * The .cxx_construct and .cxx_destruct methods that must be called for
+ * instances of a class.
+ */
+struct cxx_methods
+{
+  Class cls;
+  /**
+   * The constructors, superclass first, followed by NULL.
+   */
+  IMP *construct;
+  /**
+   * The destructors, subclass first, followed by NULL.
+   */
+  IMP *destruct;
+};
+
+static int cxx_methods_compare(const void *cls, const struct cxx_methods *m)
+{
+  return (Class)cls == m->cls;
+}
+static int cxx_methods_hash_class(const void *cls)
+{
+  return (int)(((uintptr_t)cls) >> 4);
+}
+static int cxx_methods_hash(const struct cxx_methods *m)
+{
+  return cxx_methods_hash_class(m->cls);
+}
+#define MAP_TABLE_NAME cxx_methods
+#define MAP_TABLE_COMPARE_FUNCTION cxx_methods_compare
+#define MAP_TABLE_HASH_KEY cxx_methods_hash_class
+#define MAP_TABLE_HASH_VALUE cxx_methods_hash
+#include "hash_table.h"
+
+/**
+ * The cached C++ constructor and destructor chains for classes that have
+ * objc_class_flag_has_cxx_methods set.
+ */
+static cxx_methods_table *cxx_method_cache;
+
 uint64_t dtable_bytes = 0;
 
 extern uint64_t sparseArrayBytes;
@@ -61,7 +113,8 @@ PRIVATE void log_dtable_memory_usage(void)
  */
 PRIVATE void init_dispatch_tables(void)
 {
-  LOCK(&initialize_lock);
+  INIT_LOCK(dtable_lock);
+  cxx_methods_initialize(&cxx_method_cache, 64);
 }
 
 /**
@@ -77,38 +130,307 @@ static BOOL ownsMethod(Class cls, SEL sel)
   return NO;
 }
 
-/**
- * Checks for ARC accessors, based on the dtable.
- */
-PRIVATE void checkARCAccessors(Class cls)
+static SEL retain, release, autorelease, isARC, cxx_construct, cxx_destruct;
+
+static void init_cached_selectors(void)
 {
-  static SEL retain, release, autorelease, isARC;
   if (NULL == retain)
   {
-    retain = sel_registerName("retain");
     release = sel_registerName("release");
     autorelease = sel_registerName("autorelease");
     isARC = sel_registerName("_ARCCompliantRetainRelease");
+    cxx_construct = sel_registerName(".cxx_construct");
+    cxx_destruct = sel_registerName(".cxx_destruct");
+    retain = sel_registerName("retain");
   }
-  struct objc_slot *slot = objc_get_slot(cls, retain);
-  if ((NULL != slot) && !ownsMethod(slot->owner, isARC))
+}
+
+/**
+ * Returns whether cls inherits or implements a version of the method that
+ * does not come from a class that is ARC compliant.
+ */
+static BOOL overridesARCMethod(Class cls, SEL sel)
+{
+  struct objc_slot *slot = objc_get_slot(cls, sel);
+  return (NULL != slot) && !ownsMethod(slot->owner, isARC);
+}
+
+/**
+ * Incremented, with dtable_lock held, whenever a method that affects
+ * checkARCAccessors() or the C++ constructor and destructor chains changes.
+ * Used to detect methods changing while a class is being checked.
+ */
+static unsigned long cached_method_generation;
+
+/**
+ * Checks for ARC accessors, based on the dtable, and remembers the result
+ * until a method that could change it is added or replaced.  The class's own
+ * methods must be visible to objc_get_slot().
+ */
+static void check_arc_accessors(Class cls)
+{
+  init_cached_selectors();
+  unsigned long generation =
+    __atomic_load_n(&cached_method_generation, __ATOMIC_ACQUIRE);
+  BOOL fast = !overridesARCMethod(cls, retain) &&
+              !overridesARCMethod(cls, release) &&
+              !overridesARCMethod(cls, autorelease);
+  LOCK_FOR_SCOPE(&dtable_lock);
+  if (fast)
   {
-    objc_clear_class_flag(cls, objc_class_flag_fast_arc);
-    return;
+    __atomic_fetch_or(&cls->info, objc_class_flag_fast_arc, __ATOMIC_RELAXED);
   }
-  slot = objc_get_slot(cls, release);
-  if ((NULL != slot) && !ownsMethod(slot->owner, isARC))
+  else
+  {
+    __atomic_fetch_and(&cls->info, ~(unsigned long)objc_class_flag_fast_arc,
+        __ATOMIC_RELAXED);
+  }
+  // If a method changed while we were looking, then the answer may be out of
+  // date, so check again next time.
+  if (generation == cached_method_generation)
+  {
+    __atomic_fetch_or(&cls->info, objc_class_flag_arc_checked, __ATOMIC_RELEASE);
+  }
+}
+
+PRIVATE void checkARCAccessors(Class cls)
+{
+  if (__atomic_load_n(&cls->info, __ATOMIC_ACQUIRE) & objc_class_flag_arc_checked)
   {
-    objc_clear_class_flag(cls, objc_class_flag_fast_arc);
     return;
   }
-  slot = objc_get_slot(cls, autorelease);
-  if ((NULL != slot) && !ownsMethod(slot->owner, isARC))
+  // A class's own methods are not in the dtables until it is initialised, so
+  // an uninitialised class is left on the slow path.  objc_send_initialize()
+  // checks it once its methods are visible.
+  if (!is_initialised(cls))
   {
-    objc_clear_class_flag(cls, objc_class_flag_fast_arc);
     return;
   }
-  objc_set_class_flag(cls, objc_class_flag_fast_arc);
+  check_arc_accessors(cls);
+}
+
+/**
+ * Returns a NULL-terminated array of the implementations of sel that must be
+ * called for an instance of cls, in superclass-first order if reverse is set
+ * or subclass-first order otherwise, or NULL if there are none.
+ */
+static IMP *copy_cxx_chain(Class cls, SEL sel, BOOL reverse)
+{
+  unsigned count = 0;
+  for (Class c = cls ; Nil != c ; count++)
+  {
+    struct objc_slot *slot = objc_get_slot(c, sel);
+    if (NULL == slot) { break; }
+    c = slot->owner->super_class;
+  }
+  if (0 == count)
+  {
+    return NULL;
+  }
+  IMP *chain = calloc(count + 1, sizeof(IMP));
+  unsigned i = 0;
+  for (Class c = cls ; (Nil != c) && (i < count) ; i++)
+  {
+    struct objc_slot *slot = objc_get_slot(c, sel);
+    if (NULL == slot) { break; }
+    chain[reverse ? count - i - 1 : i] = slot->method;
+    c = slot->owner->super_class;
+  }
+  return chain;
+}
+
+/**
+ * Returns the implementation of sel in the method lists of a class itself, or
+ * NULL if it has none.  Unlike objc_get_slot(), this works for classes whose
+ * methods are not in the dtables yet.
+ */
+static IMP own_method(Class cls, SEL sel)
+{
+  for (struct objc_method_list *l = cls->methods; l; l = l->next)
+  {
+    for (int i = 0; i < l->count; ++i)
+    {
+      if (sel_isEqual(l->methods[i].selector, sel))
+      {
+        return l->methods[i].imp;
+      }
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Equivalent to copy_cxx_chain(), for a class that has not been initialised.
+ * The result is not cached, because methods can still be added before the
+ * class is initialised.
+ */
+static IMP *copy_uninitialised_cxx_chain(Class cls, SEL sel, BOOL reverse)
+{
+  unsigned count = 0;
+  for (Class c = cls ; Nil != c ; c = c->super_class)
+  {
+    if (NULL != own_method(c, sel)) { count++; }
+  }
+  if (0 == count)
+  {
+    return NULL;
+  }
+  IMP *chain = calloc(count + 1, sizeof(IMP));
+  unsigned i = 0;
+  for (Class c = cls ; Nil != c ; c = c->super_class)
+  {
+    IMP imp = own_method(c, sel);
+    if (NULL != imp)
+    {
+      chain[reverse ? count - i - 1 : i] = imp;
+      i++;
+    }
+  }
+  return chain;
+}
+
+/**
+ * Returns the cached constructor and destructor chains for a class, finding
+ * them if the class has not been checked since its methods last changed, or
+ * NULL if it has none.
+ */
+static struct cxx_methods *cxx_methods_for_class(Class cls)
+{
+  unsigned long info = __atomic_load_n(&cls->info, __ATOMIC_ACQUIRE);
+  if (info & objc_class_flag_cxx_checked)
+  {
+    if (0 == (info & objc_class_flag_has_cxx_methods))
+    {
+      return NULL;
+    }
+    return cxx_methods_table_get(cxx_method_cache, cls);
+  }
+  init_cached_selectors();
+  unsigned long generation =
+    __atomic_load_n(&cached_method_generation, __ATOMIC_ACQUIRE);
+  IMP *construct = copy_cxx_chain(cls, cxx_construct, YES);
+  IMP *destruct = copy_cxx_chain(cls, cxx_destruct, NO);
+  LOCK_FOR_SCOPE(&dtable_lock);
+  struct cxx_methods *m = cxx_methods_table_get(cxx_method_cache, cls);
+  if ((NULL == m) && ((NULL != construct) || (NULL != destruct)))
+  {
+    m = calloc(1, sizeof(struct cxx_methods));
+    m->cls = cls;
+    cxx_methods_insert(cxx_method_cache, m);
+  }
+  if (NULL != m)
+  {
+    // The old chains are not freed, because another thread may be using them.
+    __atomic_store_n(&m->construct, construct, __ATOMIC_RELEASE);
+    __atomic_store_n(&m->destruct, destruct, __ATOMIC_RELEASE);
+    __atomic_fetch_or(&cls->info, objc_class_flag_has_cxx_methods,
+        __ATOMIC_RELEASE);
+  }
+  if (generation == cached_method_generation)
+  {
+    __atomic_fetch_or(&cls->info, objc_class_flag_cxx_checked, __ATOMIC_RELEASE);
+  }
+  return m;
+}
+
+/**
+ * Returns the class whose C++ methods apply to instances of cls.  Hidden
+ * classes do not have constructors or destructors of their own, and are
+ * freed, so are not cached.
+ */
+static Class cxx_methods_class(Class cls)
+{
+  while (objc_test_class_flag(cls, objc_class_flag_hidden_class) ||
+         objc_test_class_flag(cls, objc_class_flag_shared_overlay))
+  {
+    cls = cls->super_class;
+  }
+  return cls;
+}
+
+PRIVATE IMP *objc_cxx_construct_methods(Class cls, BOOL *copied)
+{
+  cls = cxx_methods_class(cls);
+  // The methods of a class that is not initialised yet are not in the
+  // dtables, so its chains are found from its method lists and not cached.
+  *copied = !is_initialised(cls);
+  if (*copied)
+  {
+    init_cached_selectors();
+    return copy_uninitialised_cxx_chain(cls, cxx_construct, YES);
+  }
+  struct cxx_methods *m = cxx_methods_for_class(cls);
+  return (NULL == m) ? NULL : __atomic_load_n(&m->construct, __ATOMIC_ACQUIRE);
+}
+
+PRIVATE IMP *objc_cxx_destruct_methods(Class cls, BOOL *copied)
+{
+  cls = cxx_methods_class(cls);
+  *copied = !is_initialised(cls);
+  if (*copied)
+  {
+    init_cached_selectors();
+    return copy_uninitialised_cxx_chain(cls, cxx_destruct, NO);
+  }
+  struct cxx_methods *m = cxx_methods_for_class(cls);
+  return (NULL == m) ? NULL : __atomic_load_n(&m->destruct, __ATOMIC_ACQUIRE);
+}
+
+PRIVATE void objc_forget_cxx_methods(Class cls)
+{
+  LOCK_FOR_SCOPE(&dtable_lock);
+  struct cxx_methods *m = cxx_methods_table_get(cxx_method_cache, cls);
+  if (NULL != m)
+  {
+    cxx_methods_remove(cxx_method_cache, cls);
+    free(m->construct);
+    free(m->destruct);
+    free(m);
+  }
+}
+
+static void clear_class_flag_recursive(Class cls, enum objc_class_flags flag)
+{
+  __atomic_fetch_and(&cls->info, ~(unsigned long)flag, __ATOMIC_RELAXED);
+  for (Class sub = cls->subclass_list ; Nil != sub ; sub = sub->sibling_class)
+  {
+    clear_class_flag_recursive(sub, flag);
+  }
+}
+
+/**
+ * Forgets the cached results of checkARCAccessors() and
+ * cxx_methods_for_class() for a class and its subclasses if they depend on
+ * sel, whose method has changed.  Must be called with dtable_lock held.
+ * Existing objects keep using the old fast ARC state until the class is
+ * checked again, because their reference count words depend on it.
+ */
+static void invalidate_cached_methods(Class cls, SEL sel)
+{
+  init_cached_selectors();
+  sel = sel_getUntyped(sel);
+  if (sel_isEqual(sel, retain) || sel_isEqual(sel, release) ||
+      sel_isEqual(sel, autorelease) || sel_isEqual(sel, isARC))
+  {
+    cached_method_generation++;
+    clear_class_flag_recursive(cls, objc_class_flag_arc_checked);
+  }
+  else if (sel_isEqual(sel, cxx_construct) || sel_isEqual(sel, cxx_destruct))
+  {
+    cached_method_generation++;
+    clear_class_flag_recursive(cls, objc_class_flag_cxx_checked);
+  }
+}
+
+/**
+ * Returns the ID that identifies a class in sparse dtables, or 0 if it does
+ * not have one yet.  Classes are given an ID when their initialisation
+ * starts.
+ */
+static inline uint32_t class_id_for(Class class)
+{
+  uintptr_t state = __atomic_load_n((uintptr_t*)&class->dtable, __ATOMIC_ACQUIRE);
+  return (uint32_t)(state & ~DTABLE_INITIALIZING);
 }
 
 struct sel_dtable *dtable_get(SEL sel)
@@ -121,38 +443,123 @@ struct sel_dtable *dtable_get(SEL sel)
 }
 
 
-struct objc_slot *dtable_lookup(struct sel_dtable *dtable, Class class)
+/**
+ * Returns the entry for a class in a dtable, without looking at its
+ * superclasses.
+ */
+static struct objc_slot *dtable_slot_for_class(struct sel_dtable *dtable,
+                                               Class class)
 {
-  if (dtable->is_sparse)
+  // This may be called without dtable_lock.  The size is read first: a dtable
+  // only grows past the end of its slots array after it has become sparse, so
+  // seeing the larger size means seeing is_sparse as well.
+  uint32_t size = __atomic_load_n(&dtable->size, __ATOMIC_ACQUIRE);
+  if (__atomic_load_n(&dtable->is_sparse, __ATOMIC_ACQUIRE))
   {
-    uint32_t class_id =  (uint32_t)class->dtable;
-    while (class != Nil)
+    uint32_t class_id = class_id_for(class);
+    if (0 == class_id)
     {
-      struct objc_slot *slot = SparseArrayLookup(dtable->array, class_id);
-      if (slot != NULL)
-      {
-        return slot;
-      }
-      class = class->super_class;
+      return NULL;
     }
+    return SparseArrayLookup(__atomic_load_n(&dtable->array, __ATOMIC_ACQUIRE),
+                             class_id);
   }
-  else
+  struct objc_slot **slots = __atomic_load_n(&dtable->slots, __ATOMIC_ACQUIRE);
+  for (int i = 0; i < size; ++i)
+  {
+    struct objc_slot *slot = __atomic_load_n(&slots[i], __ATOMIC_RELAXED);
+    if (slot->owner == class)
+    {
+      return slot;
+    }
+  }
+  return NULL;
+}
+
+#ifdef LAZY_DTABLES
+/**
+ * Incremented, with dtable_lock held, whenever methods are added to a class.
+ * Used to detect method lists changing while they are being searched.
+ */
+static unsigned long method_list_generation;
+
+/**
+ * Returns the method that a class has for the selector of a dtable, without
+ * looking at its superclasses, or NULL if it does not have one.
+ */
+static Method find_method_in_class(struct sel_dtable *dtable, Class class)
+{
+  // Only untyped dtables have a list of types.  They contain every method
+  // with the same name, irrespective of its types.  Selector names are
+  // uniqued, so they can be compared by address.
+  BOOL untyped = (NULL != dtable->type_list.next);
+  const char *name = dtable->type_list.value;
+  for (struct objc_method_list *l = class->methods; l; l = l->next)
   {
-    while (class != Nil)
+    for (int i = 0; i < l->count; ++i)
     {
-      uint32_t size = dtable->size;
-      struct objc_slot **slots = dtable->slots;
-      for (int i = 0; i < size; ++i)
+      struct sel_dtable *method_dtable = dtable_get(l->methods[i].selector);
+      if ((method_dtable == dtable) ||
+          (untyped && (method_dtable->type_list.value == name)))
       {
-        struct objc_slot *slot = slots[i];
-        if (slot->owner == class)
-        {
-          return slot;
-        }
+        return &l->methods[i];
       }
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Adds the method that a class whose methods are registered lazily has for
+ * the selector of a dtable.  If the class does not have one, this adds an
+ * entry with no method, so that its method lists are only searched once for
+ * each selector.
+ *
+ * The method lists are searched without holding dtable_lock, so misses in
+ * unrelated classes do not wait for each other.  If methods were added while
+ * searching, then the search is repeated with the lock held.
+ */
+static struct objc_slot *materialize_method(struct sel_dtable *dtable,
+                                            Class class)
+{
+  unsigned long generation =
+    __atomic_load_n(&method_list_generation, __ATOMIC_ACQUIRE);
+  Method method = find_method_in_class(dtable, class);
+  LOCK_FOR_SCOPE(&dtable_lock);
+  // Another thread may have added the entry while we were searching.
+  struct objc_slot *slot = dtable_slot_for_class(dtable, class);
+  if (NULL != slot)
+  {
+    return slot;
+  }
+  if (generation != method_list_generation)
+  {
+    method = find_method_in_class(dtable, class);
+  }
+  dtable_insert(class_id_for(class), dtable, class, method, NO);
+  return dtable_slot_for_class(dtable, class);
+}
+#endif
 
-      class = class->super_class;
+struct objc_slot *dtable_lookup(struct sel_dtable *dtable, Class class)
+{
+  while (class != Nil)
+  {
+    struct objc_slot *slot = dtable_slot_for_class(dtable, class);
+#ifdef LAZY_DTABLES
+    if ((NULL == slot) &&
+        objc_test_class_flag(class, objc_class_flag_lazy_dtable))
+    {
+      slot = materialize_method(dtable, class);
+    }
+#endif
+    // Entries without a method record that the class does not implement the
+    // selector.
+    if ((NULL != slot) && (NULL != slot->method))
+    {
+      return slot;
     }
+    class = class->super_class;
   }
   return NULL;
 }
@@ -167,6 +574,35 @@ static inline void clear_cache(struct sel_dtable *dtable)
 #endif
 }
 
+/**
+ * Replaces the method in a slot.  The slot may previously have recorded that
+ * the class does not implement the selector.
+ */
+static void set_slot_method(struct objc_slot *slot, Method method)
+{
+  slot->types = method->selector->types;
+  slot->selector = method->selector;
+  slot->method = method->imp;
+  slot->version += 1;
+}
+
+/**
+ * Allocates the slot for a dtable entry.  A NULL method gives an entry that
+ * records that the class does not implement the selector.
+ */
+static struct objc_slot *new_dtable_slot(Method method, Class class)
+{
+  if (NULL != method)
+  {
+    return new_slot_for_method_in_class(method, class);
+  }
+  struct objc_slot *slot = slot_pool_alloc();
+  memset(slot, 0, sizeof(struct objc_slot));
+  slot->owner = class;
+  slot->version = 1;
+  return slot;
+}
+
 void dtable_insert(
     uint32_t class_id,
     struct sel_dtable *dtable,
@@ -186,10 +622,11 @@ void dtable_insert(
       array = SparseArrayNewWithDepth(16);
       for (int i = 0; i < dtable->size; ++i)
       {
-        SparseArrayInsert(array, (uint32_t)dtable->slots[i]->owner->dtable, dtable->slots[i]);
+        SparseArrayInsert(array, class_id_for(dtable->slots[i]->owner), dtable->slots[i]);
       }
-      dtable->is_sparse = YES;
+      // Lookups without the lock may still be reading slots, which is kept.
       dtable->array = array;
+      __atomic_store_n(&dtable->is_sparse, YES, __ATOMIC_RELEASE);
     }
 
     struct objc_slot *slot = SparseArrayLookup(array, class_id);
@@ -197,13 +634,13 @@ void dtable_insert(
     {
       if (replace)
       {
-        slot->method = method->imp;
+        set_slot_method(slot, method);
       }
     }
     else
     {
-      dtable->size += 1;
-      SparseArrayInsert(array, class_id, new_slot_for_method_in_class(method, class));
+      SparseArrayInsert(array, class_id, new_dtable_slot(method, class));
+      __atomic_store_n(&dtable->size, dtable->size + 1, __ATOMIC_RELEASE);
     }
     return;
   }
@@ -224,7 +661,8 @@ void dtable_insert(
       {
         slots[i] = NULL;
       }
-      dtable->slots = slots;
+      // The old array is not freed, because lookups may still be reading it.
+      __atomic_store_n(&dtable->slots, slots, __ATOMIC_RELEASE);
       dtable->capacity = capacity;
     }
     else
@@ -237,15 +675,16 @@ void dtable_insert(
       {
         if (replace)
         {
-          dtable->slots[i]->method = method->imp;
+          set_slot_method(dtable->slots[i], method);
         }
         clear_cache(dtable);
         return;
       }
     }
 
-    slots[dtable->size] = new_slot_for_method_in_class(method, class);
-    dtable->size += 1;
+    __atomic_store_n(&slots[dtable->size], new_dtable_slot(method, class),
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&dtable->size, dtable->size + 1, __ATOMIC_RELEASE);
   }
 }
 
@@ -254,7 +693,7 @@ static void update_dtable(struct sel_dtable *dtable, Class class, Method method)
   struct objc_slot *slot = NULL;
   if (dtable->is_sparse)
   {
-    slot = SparseArrayLookup(dtable->array, (uint32_t)class->dtable);
+    slot = SparseArrayLookup(dtable->array, class_id_for(class));
   }
   else
   {
@@ -270,21 +709,23 @@ static void update_dtable(struct sel_dtable *dtable, Class class, Method method)
 
   if (slot)
   {
-    slot->method = method->imp;
-    slot->version += 1;
+    set_slot_method(slot, method);
     clear_cache(dtable);
   }
 }
 
 PRIVATE void update_method_for_class(Class class, Method method)
 {
-  LOCK_RUNTIME();
+  LOCK_FOR_SCOPE(&dtable_lock);
   update_dtable(dtable_get(method->selector), class, method);
   update_dtable(dtable_get(sel_getUntyped(method->selector)), class, method);
+  invalidate_cached_methods(class, method->selector);
 }
 
+#ifndef LAZY_DTABLES
 static void register_methods(uint64_t class_id, Class class)
 {
+  LOCK_FOR_SCOPE(&dtable_lock);
   for (struct objc_method_list *l = class->methods; l; l = l->next)
   {
     for (int i = 0; i < l->count; ++i)
@@ -300,45 +741,51 @@ static void register_methods(uint64_t class_id, Class class)
     }
   }
 }
+#endif
 
-typedef struct init_list_
-{
-  Class class;
-  uint64_t class_id;
-  struct init_list_ *next;
-} InitList;
-
-InitList *init_list;
 
+static uint64_t next_class_id = 1;
 
-static void remove_dtable(InitList* meta_buffer)
+PRIVATE void install_hidden_class_dtable(Class cls)
 {
-  LOCK(&initialize_lock);
-  InitList *buffer = meta_buffer->next;
-
-  // Install the dtables.
-  meta_buffer->class->dtable = (void *)meta_buffer->class_id;
-  buffer->class->dtable = (void *)buffer->class_id;
-
-  // Remove the look-aside buffer entry.
-  if (init_list == meta_buffer)
+  // Leave the dtable uninstalled if the superclass has not been initialized
+  // yet, so that the first message sends +initialize to it.
+  if (!objc_test_class_flag(cls->super_class, objc_class_flag_initialized))
   {
-    init_list = buffer->next;
+    return;
   }
-  else
+  objc_set_class_flag(cls, objc_class_flag_initialized);
+  cls->dtable = (void *)__sync_fetch_and_add(&next_class_id, 2);
+}
+
+/**
+ * A class whose initialisation is in progress.  Used to mark the class and
+ * its metaclass as initialised when +initialize returns, even if it throws.
+ */
+struct initializing_class
+{
+  Class class;
+  uint64_t class_id;
+  /**
+   * The metaclass, or Nil if it was already initialised.
+   */
+  Class meta;
+  uint64_t meta_id;
+};
+
+static void finish_initialize(struct initializing_class *init)
+{
+  // Release ordering means that anything that sees the dtable installed also
+  // sees everything that +initialize did.
+  if (Nil != init->meta)
   {
-    InitList *prev = init_list;
-    while (prev->next->class != meta_buffer->class)
-    {
-      prev = prev->next;
-    }
-    prev->next = buffer->next;
+    __atomic_store_n(&init->meta->dtable, (void *)init->meta_id,
+        __ATOMIC_RELEASE);
   }
-  UNLOCK(&initialize_lock);
+  __atomic_store_n(&init->class->dtable, (void *)init->class_id,
+      __ATOMIC_RELEASE);
 }
 
-static uint64_t next_class_id = 1;
-
 void objc_send_initialize(id object)
 {
   Class class = classForObject(object);
@@ -360,37 +807,22 @@ void objc_send_initialize(id object)
     objc_send_initialize((id)class->super_class);
   }
 
-  // Lock the runtime while we're creating dtables and before we acquire any
-  // other locks.  This prevents a lock-order reversal when
-  // dtable_for_class is called from something holding the runtime lock while
-  // we're still holding the initialize lock.  We should ensure that we never
-  // acquire the runtime lock after acquiring the initialize lock.
-  LOCK_RUNTIME();
-
-  // Superclass +initialize might possibly send a message to this class, in
-  // which case this method would be called again.  See NSObject and
-  // NSAutoreleasePool +initialize interaction in GNUstep.
-  if (objc_test_class_flag(class, objc_class_flag_initialized))
-  {
-    // We know that initialization has started because the flag is set.
-    // Check that it's finished by grabbing the class lock.  This will be
-    // released once the class has been fully initialized. The runtime
-    // lock needs to be released first to prevent a deadlock between the
-    // runtime lock and the class-specific lock.
-    UNLOCK_RUNTIME();
-
-    objc_sync_enter((id)meta);
-    objc_sync_exit((id)meta);
-    assert(class->dtable);
+  if (is_initialised(class))
+  {
     return;
   }
 
+  // The metaclass's lock is held for the whole of initialisation, so other
+  // threads that send a message to the class wait here until +initialize
+  // has returned.  Classes have separate locks, so unrelated classes can be
+  // initialised in parallel.  The lock is recursive, so the thread that is
+  // running +initialize can send messages to the class.
   LOCK_OBJECT_FOR_SCOPE((id)meta);
-  LOCK(&initialize_lock);
-  if (objc_test_class_flag(class, objc_class_flag_initialized))
+
+  // Either another thread finished initialising the class while we waited
+  // for the lock, or this thread is already running its +initialize.
+  if (NULL != __atomic_load_n(&class->dtable, __ATOMIC_ACQUIRE))
   {
-    UNLOCK(&initialize_lock);
-    UNLOCK_RUNTIME();
     return;
   }
   BOOL skipMeta = objc_test_class_flag(meta, objc_class_flag_initialized);
@@ -403,20 +835,35 @@ void objc_send_initialize(id object)
   uint64_t class_id = __sync_fetch_and_add(&next_class_id, 2);
   uint64_t meta_id = class_id + 1;
 
+  // Give the classes their IDs, marked as still being initialised.  Lookups
+  // use the IDs, but is_initialised() returns NO until the cleanup installs
+  // them without the mark.
+  __attribute__((cleanup(finish_initialize)))
+  struct initializing_class init =
+    { class, class_id, skipMeta ? Nil : meta, meta_id };
+  __atomic_store_n(&class->dtable, (void *)(class_id | DTABLE_INITIALIZING),
+      __ATOMIC_RELEASE);
+  if (!skipMeta)
+  {
+    __atomic_store_n(&meta->dtable, (void *)(meta_id | DTABLE_INITIALIZING),
+        __ATOMIC_RELEASE);
+  }
+
+#ifdef LAZY_DTABLES
+  // The methods are added to the dtables the first time that each selector
+  // is looked up.
+  objc_set_class_flag(class, objc_class_flag_lazy_dtable);
+  if (!skipMeta)
+  {
+    objc_set_class_flag(meta, objc_class_flag_lazy_dtable);
+  }
+#else
   register_methods(class_id, class);
   if (!skipMeta)
   {
     register_methods(meta_id, meta);
   }
-
-  // Now we've finished doing things that may acquire the runtime lock, so we
-  // can hold onto the initialise lock to make anything doing
-  // dtable_for_class block until we've finished updating temporary dtable
-  // lists.
-  // If another thread holds the runtime lock, it can now proceed until it
-  // gets into a dtable_for_class call, and then block there waiting for us
-  // to finish setting up the temporary dtable.
-  UNLOCK_RUNTIME();
+#endif
 
   static SEL initializeSel = 0;
   if (0 == initializeSel)
@@ -426,89 +873,263 @@ void objc_send_initialize(id object)
 
   struct objc_slot *initializeSlot = skipMeta ? 0 : objc_get_slot(meta, initializeSel);
 
+  check_arc_accessors(class);
 
-  // If there's no initialize method, then don't bother installing and
-  // removing the initialize dtable, just install both dtables correctly now
+  // If there's no initialize method, then the cleanup just installs both
+  // dtables.
   if (0 == initializeSlot)
   {
-    if (!skipMeta)
+    return;
+  }
+
+  initializeSlot->method((id)class, initializeSel);
+}
+
+BOOL is_initialised(Class class)
+{
+  uintptr_t state = __atomic_load_n((uintptr_t*)&class->dtable, __ATOMIC_ACQUIRE);
+  return (0 != state) && (0 == (state & DTABLE_INITIALIZING));
+}
+
+#ifdef PREINITIALIZE_CLASSES
+#include <pthread.h>
+
+/**
+ * Classes that do not have a +initialize method are initialised by a
+ * background thread after they are loaded, so that the first message sent
+ * to them does not have to do it.  Initialisation is safe to run on any
+ * thread, so if a message is sent first then the background thread simply
+ * finds the class already initialised.
+ *
+ * Classes are only queued once the module that loaded them has been fully
+ * loaded, so +load methods and categories in the same module, which may
+ * install +initialize, have been seen.  The thread is started the first time
+ * that a class is queued.
+ */
+static pthread_mutex_t preinitialize_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t preinitialize_condition = PTHREAD_COND_INITIALIZER;
+/**
+ * Held by the background thread while it is initialising a class, so that
+ * fork() can wait until the thread holds no runtime locks.
+ */
+static pthread_mutex_t preinitialize_busy_lock = PTHREAD_MUTEX_INITIALIZER;
+/**
+ * Classes waiting to be initialised, in the order in which they were loaded.
+ */
+static Class *preinitialize_queue;
+static size_t preinitialize_head;
+static size_t preinitialize_tail;
+static size_t preinitialize_capacity;
+static BOOL preinitialize_thread_started;
+/**
+ * Classes resolved during the current load, which are queued when it
+ * finishes.  Protected by the runtime lock.
+ */
+static Class *loaded_classes;
+static size_t loaded_class_count;
+static size_t loaded_class_capacity;
+
+/**
+ * Returns whether sending +initialize to a class would call a method.  The
+ * metaclass chain ends with the root class, so this includes instance
+ * methods of the root class.
+ */
+static BOOL has_initialize_method(Class cls)
+{
+  static struct sel_dtable *initialize;
+  if (NULL == initialize)
+  {
+    initialize = dtable_get(sel_registerName("initialize"));
+  }
+  for (Class c = cls->isa ; Nil != c ; c = c->super_class)
+  {
+    for (struct objc_method_list *l = c->methods; l; l = l->next)
+    {
+      for (int i = 0; i < l->count; ++i)
+      {
+        // Selector names are uniqued, so they can be compared by address.
+        if (dtable_get(l->methods[i].selector)->type_list.value ==
+            initialize->type_list.value)
+        {
+          return YES;
+        }
+      }
+    }
+  }
+  return NO;
+}
+
+static void *preinitialize_classes(void *unused)
+{
+  for (;;)
+  {
+    pthread_mutex_lock(&preinitialize_lock);
+    while (preinitialize_head == preinitialize_tail)
     {
-      meta->dtable = (void *)meta_id;
+      pthread_cond_wait(&preinitialize_condition, &preinitialize_lock);
     }
-    class->dtable = (void *)class_id;
-    checkARCAccessors(class);
-    UNLOCK(&initialize_lock);
-    return;
+    Class cls = preinitialize_queue[preinitialize_head++];
+    pthread_mutex_unlock(&preinitialize_lock);
+    pthread_mutex_lock(&preinitialize_busy_lock);
+    // A category loaded since the class was queued may have added a
+    // +initialize method.
+    if (!is_initialised(cls) && !has_initialize_method(cls))
+    {
+      objc_send_initialize((id)cls);
+    }
+    pthread_mutex_unlock(&preinitialize_busy_lock);
   }
+  return NULL;
+}
 
-  // Create an entry in the dtable look-aside buffer for this.  When sending
-  // a message to this class in future, the lookup function will check this
-  // buffer if the receiver's dtable is not installed, and block if
-  // attempting to send a message to this class.
-  InitList buffer = { class, class_id, init_list };
-  __attribute__((cleanup(remove_dtable)))
-  InitList meta_buffer = { meta, meta_id, &buffer };
-  init_list = &meta_buffer;
+/**
+ * fork() handlers.  The background thread does not exist in the child, so
+ * fork waits until it is not initialising a class, and the child starts a
+ * new thread the next time that a class is queued.
+ */
+static void preinitialize_prepare_fork(void)
+{
+  pthread_mutex_lock(&preinitialize_busy_lock);
+  pthread_mutex_lock(&preinitialize_lock);
+}
 
-  // We now release the initialize lock.  We'll reacquire it later when we do
-  // the cleanup, but at this point we allow other threads to get the
-  // temporary dtable and call +initialize in other threads.
-  UNLOCK(&initialize_lock);
-  // We still hold the class lock at this point.  dtable_for_class will block
-  // there after acquiring the temporary dtable.
+static void preinitialize_parent_fork(void)
+{
+  pthread_mutex_unlock(&preinitialize_lock);
+  pthread_mutex_unlock(&preinitialize_busy_lock);
+}
 
-  checkARCAccessors(class);
+static void preinitialize_child_fork(void)
+{
+  pthread_mutex_init(&preinitialize_lock, NULL);
+  pthread_mutex_init(&preinitialize_busy_lock, NULL);
+  pthread_cond_init(&preinitialize_condition, NULL);
+  preinitialize_thread_started = NO;
+}
 
-  // Store the buffer in the temporary dtables list.  Note that it is safe to
-  // insert it into a global list, even though it's a temporary variable,
-  // because we will clean it up after this function.
-  initializeSlot->method((id)class, initializeSel);
+static void register_fork_handlers(void)
+{
+  pthread_atfork(preinitialize_prepare_fork, preinitialize_parent_fork,
+      preinitialize_child_fork);
 }
 
-BOOL is_initialised(Class class)
+/**
+ * Adds a class to the queue.  Must be called with preinitialize_lock held.
+ */
+static void queue_class(Class cls)
 {
-  if (class->dtable)
+  if (preinitialize_head == preinitialize_tail)
   {
-    return YES;
+    preinitialize_head = preinitialize_tail = 0;
   }
+  if (preinitialize_tail == preinitialize_capacity)
+  {
+    // Reclaim the space used by classes that have already been taken.
+    size_t count = preinitialize_tail - preinitialize_head;
+    memmove(preinitialize_queue, preinitialize_queue + preinitialize_head,
+        count * sizeof(Class));
+    preinitialize_head = 0;
+    preinitialize_tail = count;
+    if (count * 2 > preinitialize_capacity)
+    {
+      preinitialize_capacity =
+        (0 == preinitialize_capacity) ? 256 : preinitialize_capacity * 2;
+      preinitialize_queue = realloc(preinitialize_queue,
+          preinitialize_capacity * sizeof(Class));
+    }
+  }
+  preinitialize_queue[preinitialize_tail++] = cls;
+}
 
-  if (!objc_test_class_flag(class, objc_class_flag_initialized))
+PRIVATE void objc_preinitialize_class(Class cls)
+{
+  if (loaded_class_count == loaded_class_capacity)
   {
-    return NO;
+    loaded_class_capacity =
+      (0 == loaded_class_capacity) ? 64 : loaded_class_capacity * 2;
+    loaded_classes = realloc(loaded_classes,
+        loaded_class_capacity * sizeof(Class));
   }
+  loaded_classes[loaded_class_count++] = cls;
+}
 
-  BOOL wait;
+PRIVATE void objc_preinitialize_loaded_classes(void)
+{
+  if (0 == loaded_class_count)
+  {
+    return;
+  }
+  static pthread_once_t once = PTHREAD_ONCE_INIT;
+  pthread_once(&once, register_fork_handlers);
+  pthread_mutex_lock(&preinitialize_lock);
+  BOOL queued = NO;
+  for (size_t i=0 ; i<loaded_class_count ; i++)
   {
-    LOCK_FOR_SCOPE(&initialize_lock);
-    InitList *list = init_list;
-    while (list)
+    if (!has_initialize_method(loaded_classes[i]))
     {
-      if (list->class == class)
-      {
-        wait = YES;
-        break;
-      }
-      list = list->next;
+      queue_class(loaded_classes[i]);
+      queued = YES;
     }
   }
+  loaded_class_count = 0;
+  if (queued && !preinitialize_thread_started)
+  {
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    preinitialize_thread_started =
+      (0 == pthread_create(&thread, &attr, preinitialize_classes, NULL));
+    pthread_attr_destroy(&attr);
+  }
+  pthread_cond_signal(&preinitialize_condition);
+  pthread_mutex_unlock(&preinitialize_lock);
+}
+#endif
 
-  if (wait)
+static void add_method_to_dtable(uint32_t class_id,
+                                 struct sel_dtable *dtable,
+                                 Class cls,
+                                 Method method)
+{
+  // Lazily populated classes find the new method in their method lists the
+  // next time that the selector is looked up, so only an existing entry
+  // needs to be changed.
+  if (objc_test_class_flag(cls, objc_class_flag_lazy_dtable))
+  {
+    struct objc_slot *slot = dtable_slot_for_class(dtable, cls);
+    if (NULL != slot)
+    {
+      set_slot_method(slot, method);
+    }
+  }
+  else
   {
-    objc_sync_enter((id)class);
-    objc_sync_exit((id)class);
+    dtable_insert(class_id, dtable, cls, method, YES);
   }
-  return YES;
+  // Subclasses that inherited a different implementation may be cached.
+  clear_cache(dtable);
 }
 
 PRIVATE void add_method_list_to_class(Class cls, struct objc_method_list *methods)
 {
+  LOCK_FOR_SCOPE(&dtable_lock);
+#ifdef LAZY_DTABLES
+  __atomic_store_n(&method_list_generation, method_list_generation + 1,
+      __ATOMIC_RELEASE);
+#endif
+  uint32_t class_id = class_id_for(cls);
   for (int i = 0; i < methods->count; ++i)
   {
     struct objc_method *m = &methods->methods[i];
-    SEL typed = m->selector;
-    SEL untyped = sel_getUntyped(typed);
-    dtable_insert((uint64_t)cls->dtable, dtable_get(typed), cls, m, YES);
-    dtable_insert((uint64_t)cls->dtable, dtable_get(untyped), cls, m, YES);
+    struct sel_dtable *typed = dtable_get(m->selector);
+    struct sel_dtable *untyped = dtable_get(sel_getUntyped(m->selector));
+    add_method_to_dtable(class_id, typed, cls, m);
+    if (typed != untyped)
+    {
+      add_method_to_dtable(class_id, untyped, cls, m);
+    }
+    invalidate_cached_methods(cls, m->selector);
   }
 }
 
@@ -520,8 +1141,9 @@ static void remove_method(struct sel_dtable *dtable, Class class)
     {
       if (dtable->slots[i]->owner == class)
       {
-        dtable->slots[i] = dtable->slots[dtable->size - 1];
-        dtable->size -= 1;
+        __atomic_store_n(&dtable->slots[i], dtable->slots[dtable->size - 1],
+                         __ATOMIC_RELEASE);
+        __atomic_store_n(&dtable->size, dtable->size - 1, __ATOMIC_RELEASE);
         break;
       }
     }
@@ -548,6 +1170,15 @@ static void clear_caches(Class class)
 
 void remove_class(Class class)
 {
+  LOCK_FOR_SCOPE(&dtable_lock);
+  // Hidden classes are never added to the selector caches, so we only need
+  // to clear the caches for the selectors that this class implements, which
+  // remove_method() does.  Overlay classes are cached, so any selector that
+  // they respond to may have an entry for them.
+  if (objc_test_class_flag(class, objc_class_flag_shared_overlay))
+  {
+    clear_caches(class);
+  }
   for (struct objc_method_list *l = class->methods; l; l = l->next)
   {
     for (int i = 0; i < l->count; ++i)
@@ -559,5 +1190,4 @@ void remove_class(Class class)
       remove_method(dtable_get(untyped), class);
     }
   }
-  clear_caches(class);
 }
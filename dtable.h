@@ -12,9 +12,29 @@
 /**
  * Checks whether the class supports ARC.
  *
- * This can be used before the dtable is installed.
+ * This does nothing for a class that has not been initialised, because its
+ * methods are not in the dtables yet.  Such classes use the slow path until
+ * objc_send_initialize() checks them.
  */
 void checkARCAccessors(Class cls);
+/**
+ * Returns the .cxx_construct methods to call for a new instance of a class,
+ * superclass first, terminated by NULL, or NULL if there are none.  The
+ * result is cached until a .cxx_construct or .cxx_destruct method changes,
+ * except for classes that have not been initialised.  For those, copied is
+ * set to YES and the caller must free the result.
+ */
+IMP *objc_cxx_construct_methods(Class cls, BOOL *copied);
+/**
+ * Returns the .cxx_destruct methods to call for an instance of a class,
+ * subclass first, terminated by NULL, or NULL if there are none.  The result
+ * must be freed if copied is set to YES.
+ */
+IMP *objc_cxx_destruct_methods(Class cls, BOOL *copied);
+/**
+ * Discards the cached C++ methods for a class that is being freed.
+ */
+void objc_forget_cxx_methods(Class cls);
 
 /**
  * Returns or creates a dispatch table.
@@ -27,7 +47,8 @@ struct sel_dtable *dtable_get(SEL sel);
 struct objc_slot *dtable_lookup(struct sel_dtable *dtable, Class class);
 
 /**
- * Adds a method to a dtable.
+ * Adds a method to a dtable.  If method is NULL, this records that the class
+ * does not implement the selector.
  */
 void dtable_insert(
     uint32_t class_id,
@@ -47,16 +68,39 @@ void update_method_for_class(Class class, Method method);
 void objc_send_initialize(id object);
 
 /**
- * Checks if a class was initialised.
+ * Checks if a class has finished being initialised.  Returns NO while its
+ * +initialize method is running, so that other threads call
+ * objc_send_initialize() and wait for it.
  */
 BOOL is_initialised(Class class);
 
+#ifdef PREINITIALIZE_CLASSES
+/**
+ * Records a newly resolved class, to be initialised by a background thread
+ * once the current load has finished if it does not have a +initialize
+ * method.  Must be called with the runtime lock held.
+ */
+void objc_preinitialize_class(Class cls);
+/**
+ * Queues the classes recorded by objc_preinitialize_class().  Called with the
+ * runtime lock held at the end of each load, after +load methods have run
+ * and categories have been attached.
+ */
+void objc_preinitialize_loaded_classes(void);
+#endif
+
 /**
  * Adds methods to a class.
  */
 void add_method_list_to_class(Class cls, struct objc_method_list *methods);
 
 /**
- * Removes the hidden class.
+ * Removes a hidden or overlay class from the dispatch tables.
  */
 void remove_class(Class class);
+
+/**
+ * Installs the dtable for a newly allocated hidden or overlay class, without
+ * sending +initialize, if its superclass has already been initialized.
+ */
+void install_hidden_class_dtable(Class cls);
@@ -0,0 +1,73 @@
+/**
+ * Lightweight epoch-based grace periods.
+ *
+ * Readers bracket accesses to memory that a writer may free with
+ * epoch_enter() and epoch_exit().  A writer first makes the memory unreachable
+ * to new readers and then calls epoch_synchronize(), which returns once every
+ * reader that might still have seen the old value has left its critical
+ * section.  Readers never block.  Writers must be serialised by the caller,
+ * for example by holding a lock.
+ */
+#ifndef __LIBOBJC_EPOCH_H_INCLUDED__
+#define __LIBOBJC_EPOCH_H_INCLUDED__
+#include <stdint.h>
+#include <sched.h>
+
+struct epoch
+{
+  /** The current epoch.  Only the low bit is used to select a counter. */
+  volatile uintptr_t current;
+  /** Number of readers in even and odd epochs. */
+  volatile uintptr_t active[2];
+};
+
+/**
+ * Enters a read-side critical section.  The returned value must be passed to
+ * epoch_exit().
+ */
+static inline uintptr_t epoch_enter(struct epoch *e)
+{
+  for (;;)
+  {
+    uintptr_t current = e->current;
+    __sync_add_and_fetch(&e->active[current & 1], 1);
+    // If a writer advanced the epoch between reading it and registering, then
+    // it may already have finished waiting for this counter.  Try again so
+    // that we are counted in an epoch that a future writer will wait for.
+    if (current == e->current)
+    {
+      return current;
+    }
+    __sync_sub_and_fetch(&e->active[current & 1], 1);
+  }
+}
+
+/**
+ * Leaves a read-side critical section.
+ */
+static inline void epoch_exit(struct epoch *e, uintptr_t current)
+{
+  __sync_sub_and_fetch(&e->active[current & 1], 1);
+}
+
+/**
+ * Waits until all readers that entered before this call have exited.  The
+ * caller must hold whatever lock serialises writers.
+ */
+static inline void epoch_synchronize(struct epoch *e)
+{
+  __sync_synchronize();
+  // Nobody is reading, so nobody can have seen the old value.
+  if ((0 == e->active[0]) && (0 == e->active[1]))
+  {
+    return;
+  }
+  uintptr_t old = __sync_fetch_and_add(&e->current, 1);
+  while (0 != e->active[old & 1])
+  {
+    sched_yield();
+  }
+  __sync_synchronize();
+}
+
+#endif // __LIBOBJC_EPOCH_H_INCLUDED__
@@ -2,19 +2,268 @@
 #include "objc/runtime.h"
 #include "gc_ops.h"
 #include "class.h"
+#include "refcount.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <pthread.h>
+
+/**
+ * Regions.  While a region is active on a thread, objects that the thread
+ * allocates are carved from chunks that belong to the region, and freeing
+ * them does not release any memory.  The chunks are reclaimed when the region
+ * is popped, by which time all of its objects must have been deallocated.
+ */
+
+/**
+ * Size of region chunks.  Chunks are aligned on this size, so the chunk that
+ * contains an object can be found from its address.
+ */
+#define REGION_CHUNK_SIZE (64 * 1024)
+/**
+ * Number of empty chunks that each thread keeps for its next region.
+ */
+#define REGION_SPARE_CHUNKS 16
+
+struct region_chunk
+{
+  struct region_chunk *next;
+} __attribute__((aligned(16)));
+
+struct region
+{
+  struct region *previous;
+  /**
+   * The autorelease pool that was pushed with this region.
+   */
+  void *pool;
+  struct region_chunk *chunks;
+  char *bump;
+  char *end;
+};
+
+struct region_thread
+{
+  struct region *current;
+  struct region_chunk *spare;
+  unsigned spare_count;
+};
+
+static int region_chunk_compare(const void *key, const void *chunk)
+{
+  return key == chunk;
+}
+static int region_chunk_hash(const void *chunk)
+{
+  return (int)(((uintptr_t)chunk) / REGION_CHUNK_SIZE);
+}
+#define MAP_TABLE_NAME region_chunk
+#define MAP_TABLE_COMPARE_FUNCTION region_chunk_compare
+#define MAP_TABLE_HASH_KEY region_chunk_hash
+#define MAP_TABLE_HASH_VALUE region_chunk_hash
+#include "hash_table.h"
+
+/**
+ * Every chunk that currently belongs to a region or is a spare.
+ */
+static region_chunk_table *region_chunks;
+static pthread_key_t region_key;
+/**
+ * Set once the first region has been created.  Until then, allocation does
+ * not need to look for a region.
+ */
+static int regions_used;
+
+static void free_chunk(struct region_chunk *chunk)
+{
+  region_chunk_remove(region_chunks, chunk);
+  free(chunk);
+}
+
+/**
+ * Gives the chunks of a region back to the thread's spares, or frees them if
+ * there are enough spares already.
+ */
+static void release_region(struct region_thread *t, struct region *r)
+{
+  struct region_chunk *next;
+  for (struct region_chunk *c = r->chunks ; NULL != c ; c = next)
+  {
+    next = c->next;
+    if (t->spare_count < REGION_SPARE_CHUNKS)
+    {
+      c->next = t->spare;
+      t->spare = c;
+      t->spare_count++;
+    }
+    else
+    {
+      free_chunk(c);
+    }
+  }
+  free(r);
+}
+
+static void destroy_region_thread(void *thread)
+{
+  struct region_thread *t = thread;
+  while (NULL != t->current)
+  {
+    struct region *r = t->current;
+    t->current = r->previous;
+    release_region(t, r);
+  }
+  struct region_chunk *next;
+  for (struct region_chunk *c = t->spare ; NULL != c ; c = next)
+  {
+    next = c->next;
+    free_chunk(c);
+  }
+  free(t);
+}
+
+static void init_regions(void)
+{
+  region_chunk_initialize(&region_chunks, 32);
+  pthread_key_create(&region_key, destroy_region_thread);
+  __atomic_store_n(&regions_used, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Returns zeroed memory from the current thread's region, or NULL if there is
+ * no region or the allocation is too big for one.
+ */
+static void *region_allocate(size_t size)
+{
+  struct region_thread *t = pthread_getspecific(region_key);
+  if ((NULL == t) || (NULL == t->current))
+  {
+    return NULL;
+  }
+  struct region *r = t->current;
+  size = (size + 15) & ~(size_t)15;
+  if (size > REGION_CHUNK_SIZE - sizeof(struct region_chunk))
+  {
+    return NULL;
+  }
+  if ((size_t)(r->end - r->bump) < size)
+  {
+    struct region_chunk *chunk = t->spare;
+    if (NULL != chunk)
+    {
+      t->spare = chunk->next;
+      t->spare_count--;
+    }
+    else
+    {
+      if (0 != posix_memalign((void**)&chunk, REGION_CHUNK_SIZE,
+                              REGION_CHUNK_SIZE))
+      {
+        return NULL;
+      }
+      region_chunk_insert(region_chunks, chunk);
+    }
+    chunk->next = r->chunks;
+    r->chunks = chunk;
+    r->bump = (char*)(chunk + 1);
+    r->end = (char*)chunk + REGION_CHUNK_SIZE;
+  }
+  void *block = r->bump;
+  r->bump += size;
+  // Chunks are reused, so the memory may not be clean.
+  memset(block, 0, size);
+  return block;
+}
+
+/**
+ * Returns whether memory was allocated from a region.
+ */
+static inline BOOL in_region(void *addr)
+{
+  if (!__atomic_load_n(&regions_used, __ATOMIC_ACQUIRE))
+  {
+    return NO;
+  }
+  void *chunk = (void*)((uintptr_t)addr & ~(uintptr_t)(REGION_CHUNK_SIZE - 1));
+  return NULL != region_chunk_table_get(region_chunks, chunk);
+}
+
+PRIVATE void *objc_region_begin(void *pool)
+{
+  static pthread_once_t once = PTHREAD_ONCE_INIT;
+  pthread_once(&once, init_regions);
+  struct region_thread *t = pthread_getspecific(region_key);
+  if (NULL == t)
+  {
+    t = calloc(1, sizeof(struct region_thread));
+    pthread_setspecific(region_key, t);
+  }
+  struct region *r = calloc(1, sizeof(struct region));
+  r->previous = t->current;
+  r->pool = pool;
+  t->current = r;
+  return r;
+}
+
+PRIVATE void *objc_region_pool(void *region)
+{
+  return ((struct region*)region)->pool;
+}
+
+PRIVATE void objc_region_end(void *region)
+{
+  struct region_thread *t = pthread_getspecific(region_key);
+  if (NULL == t)
+  {
+    return;
+  }
+  // Regions that were not popped are popped with the region that contains
+  // them, as with autorelease pools.
+  for (struct region *r = t->current ; NULL != r ; r = t->current)
+  {
+    t->current = r->previous;
+    release_region(t, r);
+    if (r == region)
+    {
+      break;
+    }
+  }
+}
 
 static id allocate_class(Class cls, size_t extraBytes)
 {
-  intptr_t *addr = calloc(cls->instance_size + extraBytes + sizeof(intptr_t), 1);
-  return (id)(addr + 1);
+  size_t size = cls->instance_size + extraBytes + OBJECT_HEADER_SIZE;
+  uintptr_t *addr = NULL;
+  if (__atomic_load_n(&regions_used, __ATOMIC_ACQUIRE))
+  {
+    addr = region_allocate(size);
+  }
+  if (NULL == addr)
+  {
+    addr = calloc(size, 1);
+    if (NULL == addr) { return nil; }
+  }
+  id obj = (id)(addr + OBJECT_HEADER_WORDS);
+#ifdef INLINE_WEAK_REFS
+  // Only fast-ARC objects have their reference count word managed by the
+  // runtime, so only they can use the inline weak reference slot.
+  if (objc_test_class_flag(cls, objc_class_flag_fast_arc))
+  {
+    *refcount_for_object(obj) = refcount_weak_slot;
+  }
+#endif
+  return obj;
 }
 
 static void free_object(id obj)
 {
-  free((void*)(((intptr_t*)obj) - 1));
+  void *addr = ((uintptr_t*)obj) - OBJECT_HEADER_WORDS;
+  // Region memory is reclaimed when the region is popped.
+  if (in_region(addr))
+  {
+    return;
+  }
+  free(addr);
 }
 
 static void *alloc(size_t size)
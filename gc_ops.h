@@ -12,6 +12,12 @@ struct gc_ops
    * Allocates enough space for a class, followed by some extra bytes.
    */
   id (*allocate_class)(Class, size_t);
+  /**
+   * Allocates space for up to count instances of a class, storing them in the
+   * array.  Returns the number allocated.  Optional: if this is NULL, then
+   * allocate_class is called for each object.
+   */
+  unsigned (*allocate_class_batch)(Class, size_t, id*, unsigned);
   /**
    * Frees an object.
    */
@@ -77,3 +83,4 @@ extern struct gc_ops *gc;
 
 extern struct gc_ops gc_ops_boehm;
 extern struct gc_ops gc_ops_none;
+extern struct gc_ops gc_ops_pool;
@@ -0,0 +1,396 @@
+/**
+ * An object allocator for runtimes built without garbage collection, used
+ * when the LIBOBJC_OBJECT_ALLOCATOR environment variable is set to "pool".
+ *
+ * Objects are rounded up to one of a small number of size classes.  Each
+ * thread has a free list for each size class, so allocating and freeing an
+ * object normally does not take any locks.  When a thread's free list is
+ * empty, it takes a batch of objects from a global list for the size class,
+ * or carves new ones from a large chunk of memory.  When a thread's list gets
+ * too long, half of it is returned to the global list, so that objects
+ * allocated in one thread and freed in another are not lost.
+ *
+ * New chunks are allocated with calloc(), which gets zeroed pages from the
+ * operating system for allocations of this size, so objects carved from them
+ * are not cleared again.  Objects taken from a free list are cleared when
+ * they are allocated, and only as far as the new object needs.
+ *
+ * Each block has a one-word tag in front of the object header, recording its
+ * size class.  Objects that are too big for any size class are allocated
+ * with calloc() and have a tag that says so.  Memory in chunks is never
+ * returned to the operating system.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "objc/runtime.h"
+#include "visibility.h"
+#include "gc_ops.h"
+#include "class.h"
+#include "lock.h"
+#include "refcount.h"
+
+/**
+ * Blocks are multiples of this size, which is also the alignment of objects.
+ */
+#define POOL_GRANULE 16
+/**
+ * Number of size classes.  Blocks bigger than POOL_GRANULE * POOL_CLASSES
+ * bytes are allocated with calloc().
+ */
+#define POOL_CLASSES 64
+/**
+ * Size of the chunks that blocks are carved from.
+ */
+#define POOL_CHUNK_SIZE (256 * 1024)
+/**
+ * A thread's free list for a size class is trimmed to half this length when
+ * it reaches it.  This is also the most blocks that a thread takes from a
+ * global list at once.
+ */
+#define POOL_THREAD_LIMIT 512
+/**
+ * Tag for blocks that were allocated with calloc().
+ */
+#define POOL_LARGE ((uintptr_t)-1)
+/**
+ * Bytes in front of the object: the tag and the object header, rounded up so
+ * that the object is aligned.
+ */
+#define POOL_PREFIX_SIZE \
+  ((sizeof(uintptr_t) + OBJECT_HEADER_SIZE + POOL_GRANULE - 1) & \
+   ~(size_t)(POOL_GRANULE - 1))
+
+struct pool_block
+{
+  struct pool_block *next;
+};
+
+struct pool_list
+{
+  struct pool_block *head;
+  unsigned count;
+};
+
+/**
+ * Per-thread allocator state.
+ */
+struct pool_thread
+{
+  struct pool_list lists[POOL_CLASSES];
+  /**
+   * The unused part of the chunk that this thread is carving blocks from.
+   */
+  char *bump;
+  char *bump_end;
+  uint64_t allocations;
+  uint64_t frees;
+  uint64_t cleared;
+};
+
+/**
+ * Global free lists, shared by all threads.
+ */
+static struct
+{
+  mutex_t lock;
+  struct pool_list list;
+} global_lists[POOL_CLASSES];
+
+static pthread_key_t pool_thread_key;
+
+/**
+ * Statistics.  Allocations, frees and cleared blocks are counted per thread
+ * and added to these when a thread exits.
+ */
+static uint64_t stat_allocations;
+static uint64_t stat_frees;
+static uint64_t stat_cleared;
+static uint64_t stat_large;
+static uint64_t stat_chunks;
+static uint64_t stat_refills;
+static uint64_t stat_flushes;
+
+static inline uintptr_t *tag_for_object(id obj)
+{
+  return (uintptr_t*)((char*)obj - OBJECT_HEADER_SIZE) - 1;
+}
+
+static inline id object_for_block(char *block)
+{
+  return (id)(block + POOL_PREFIX_SIZE);
+}
+
+static inline char *block_for_object(id obj)
+{
+  return (char*)obj - POOL_PREFIX_SIZE;
+}
+
+/**
+ * Moves count blocks from the front of one list to another.
+ */
+static void move_blocks(struct pool_list *from, struct pool_list *to,
+                        unsigned count)
+{
+  struct pool_block *first = from->head;
+  struct pool_block *last = first;
+  for (unsigned i=1 ; i<count ; i++)
+  {
+    last = last->next;
+  }
+  from->head = last->next;
+  from->count -= count;
+  last->next = to->head;
+  to->head = first;
+  to->count += count;
+}
+
+static void flush_thread(struct pool_thread *t)
+{
+  for (int i=0 ; i<POOL_CLASSES ; i++)
+  {
+    if (0 != t->lists[i].count)
+    {
+      LOCK_FOR_SCOPE(&global_lists[i].lock);
+      move_blocks(&t->lists[i], &global_lists[i].list, t->lists[i].count);
+    }
+  }
+  __atomic_fetch_add(&stat_allocations, t->allocations, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&stat_frees, t->frees, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&stat_cleared, t->cleared, __ATOMIC_RELAXED);
+  t->allocations = t->frees = t->cleared = 0;
+}
+
+static void destroy_thread(void *t)
+{
+  flush_thread(t);
+  free(t);
+}
+
+static inline struct pool_thread *get_thread(void)
+{
+  struct pool_thread *t = pthread_getspecific(pool_thread_key);
+  if (NULL == t)
+  {
+    t = calloc(1, sizeof(struct pool_thread));
+    pthread_setspecific(pool_thread_key, t);
+  }
+  return t;
+}
+
+/**
+ * Returns a new block of the specified size class, carved from the thread's
+ * current chunk.  The block is zeroed.
+ */
+static char *carve_block(struct pool_thread *t, uintptr_t size_class)
+{
+  size_t size = (size_class + 1) * POOL_GRANULE;
+  if ((size_t)(t->bump_end - t->bump) < size)
+  {
+    // The rest of the old chunk is wasted, but it is smaller than a block.
+    t->bump = calloc(1, POOL_CHUNK_SIZE);
+    if (NULL == t->bump)
+    {
+      t->bump_end = NULL;
+      return NULL;
+    }
+    t->bump_end = t->bump + POOL_CHUNK_SIZE;
+    __atomic_fetch_add(&stat_chunks, 1, __ATOMIC_RELAXED);
+  }
+  char *block = t->bump;
+  t->bump += size;
+  return block;
+}
+
+/**
+ * Returns a zeroed block of the specified size class, of which the first size
+ * bytes will be used.
+ */
+static char *allocate_block(struct pool_thread *t, uintptr_t size_class,
+                            size_t size)
+{
+  struct pool_list *list = &t->lists[size_class];
+  if (NULL == list->head)
+  {
+    LOCK_FOR_SCOPE(&global_lists[size_class].lock);
+    struct pool_list *global = &global_lists[size_class].list;
+    unsigned count = global->count;
+    if (count > POOL_THREAD_LIMIT / 2)
+    {
+      count = POOL_THREAD_LIMIT / 2;
+    }
+    if (0 != count)
+    {
+      move_blocks(global, list, count);
+      __atomic_fetch_add(&stat_refills, 1, __ATOMIC_RELAXED);
+    }
+  }
+  t->allocations++;
+  char *block;
+  if (NULL != list->head)
+  {
+    block = (char*)list->head;
+    list->head = list->head->next;
+    list->count--;
+    // Reused blocks are cleared here, rather than when they are freed, and
+    // only as far as this object needs.
+    memset(block, 0, size);
+    t->cleared++;
+  }
+  else
+  {
+    block = carve_block(t, size_class);
+  }
+  return block;
+}
+
+/**
+ * Turns a block into an object of the specified class.
+ */
+static inline id init_object(char *block, uintptr_t size_class, Class cls)
+{
+  id obj = object_for_block(block);
+  *tag_for_object(obj) = size_class;
+#ifdef INLINE_WEAK_REFS
+  // Only fast-ARC objects have their reference count word managed by the
+  // runtime, so only they can use the inline weak reference slot.
+  if (objc_test_class_flag(cls, objc_class_flag_fast_arc))
+  {
+    *refcount_for_object(obj) = refcount_weak_slot;
+  }
+#endif
+  return obj;
+}
+
+static id allocate_class(Class cls, size_t extraBytes)
+{
+  size_t size = POOL_PREFIX_SIZE + cls->instance_size + extraBytes;
+  uintptr_t size_class = (size - 1) / POOL_GRANULE;
+  char *block;
+  if (size_class >= POOL_CLASSES)
+  {
+    block = calloc(size, 1);
+    size_class = POOL_LARGE;
+    __atomic_fetch_add(&stat_large, 1, __ATOMIC_RELAXED);
+  }
+  else
+  {
+    block = allocate_block(get_thread(), size_class, size);
+  }
+  if (NULL == block) { return nil; }
+  return init_object(block, size_class, cls);
+}
+
+/**
+ * Allocates several objects of the same class.  Objects that are not reusing
+ * freed blocks are carved one after another from the same chunk, so they are
+ * next to each other in memory.
+ */
+static unsigned allocate_class_batch(Class cls, size_t extraBytes, id *objs,
+                                     unsigned count)
+{
+  size_t size = POOL_PREFIX_SIZE + cls->instance_size + extraBytes;
+  uintptr_t size_class = (size - 1) / POOL_GRANULE;
+  if (size_class >= POOL_CLASSES)
+  {
+    unsigned i;
+    for (i=0 ; i<count ; i++)
+    {
+      if (nil == (objs[i] = allocate_class(cls, extraBytes)))
+      {
+        break;
+      }
+    }
+    return i;
+  }
+  struct pool_thread *t = get_thread();
+  for (unsigned i=0 ; i<count ; i++)
+  {
+    char *block = allocate_block(t, size_class, size);
+    if (NULL == block)
+    {
+      return i;
+    }
+    objs[i] = init_object(block, size_class, cls);
+  }
+  return count;
+}
+
+static void free_object(id obj)
+{
+  uintptr_t size_class = *tag_for_object(obj);
+  char *block = block_for_object(obj);
+  if (POOL_LARGE == size_class)
+  {
+    free(block);
+    return;
+  }
+  struct pool_thread *t = get_thread();
+  struct pool_list *list = &t->lists[size_class];
+  struct pool_block *b = (struct pool_block*)block;
+  b->next = list->head;
+  list->head = b;
+  list->count++;
+  t->frees++;
+  if (list->count >= POOL_THREAD_LIMIT)
+  {
+    LOCK_FOR_SCOPE(&global_lists[size_class].lock);
+    move_blocks(list, &global_lists[size_class].list, POOL_THREAD_LIMIT / 2);
+    __atomic_fetch_add(&stat_flushes, 1, __ATOMIC_RELAXED);
+  }
+}
+
+static void *alloc(size_t size)
+{
+  return calloc(size, 1);
+}
+
+PRIVATE struct gc_ops gc_ops_pool =
+{
+  .allocate_class = allocate_class,
+  .allocate_class_batch = allocate_class_batch,
+  .free_object    = free_object,
+  .malloc         = alloc,
+  .free           = free
+};
+
+PRIVATE void log_object_allocator_stats(void)
+{
+  if (gc != &gc_ops_pool)
+  {
+    return;
+  }
+  struct pool_thread *t = pthread_getspecific(pool_thread_key);
+  if (NULL != t)
+  {
+    flush_thread(t);
+  }
+  fprintf(stderr, "%llu pool_allocations\n", (unsigned long long)stat_allocations);
+  fprintf(stderr, "%llu pool_frees\n", (unsigned long long)stat_frees);
+  fprintf(stderr, "%llu pool_cleared\n", (unsigned long long)stat_cleared);
+  fprintf(stderr, "%llu pool_large_allocations\n", (unsigned long long)stat_large);
+  fprintf(stderr, "%llu pool_chunk_bytes\n",
+      (unsigned long long)stat_chunks * POOL_CHUNK_SIZE);
+  fprintf(stderr, "%llu pool_refills\n", (unsigned long long)stat_refills);
+  fprintf(stderr, "%llu pool_flushes\n", (unsigned long long)stat_flushes);
+}
+
+/**
+ * Selects the object allocator.  Must be called before any objects are
+ * allocated.
+ */
+PRIVATE void init_object_allocator(void)
+{
+  const char *allocator = getenv("LIBOBJC_OBJECT_ALLOCATOR");
+  if ((NULL == allocator) || (0 != strcmp(allocator, "pool")))
+  {
+    return;
+  }
+  for (int i=0 ; i<POOL_CLASSES ; i++)
+  {
+    INIT_LOCK(global_lists[i].lock);
+  }
+  pthread_key_create(&pool_thread_key, destroy_thread);
+  gc = &gc_ops_pool;
+}
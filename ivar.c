@@ -8,6 +8,7 @@
 #include "ivar.h"
 #include "visibility.h"
 #include "gc_ops.h"
+#include "refcount.h"
 
 ptrdiff_t objc_alignof_type(const char *);
 ptrdiff_t objc_sizeof_type(const char *);
@@ -64,7 +65,7 @@ PRIVATE void objc_compute_ivar_offsets(Class class)
         // where we don't add any extra padding.
         if (!isGCEnabled && (ivar_size > sizeof(void*)))
         {
-          long offset = ivar_start + ivar->offset + sizeof(intptr_t);
+          long offset = ivar_start + ivar->offset + OBJECT_HEADER_SIZE;
           // For now, assume that nothing needs to be more than 16-byte aligned.
           // This is not correct for AVX vectors, but we probably
           // can't do anything about that for now (as malloc is only
@@ -73,7 +74,7 @@ PRIVATE void objc_compute_ivar_offsets(Class class)
           ivar->offset += fudge;
           class->instance_size += fudge;
           cumulative_fudge += fudge;
-          assert((ivar_start + ivar->offset + sizeof(intptr_t)) % 16 == 0);
+          assert((ivar_start + ivar->offset + OBJECT_HEADER_SIZE) % 16 == 0);
         }
         ivar->offset += ivar_start;
         /* If we're using the new ABI then we also set up the faster ivar
@@ -19,21 +19,39 @@ LEGACY void *__objc_runtime_mutex = &runtime_mutex;
 
 void init_alias_table(void);
 void init_arc(void);
+void init_associations(void);
 void init_class_tables(void);
 void init_dispatch_tables(void);
 void init_gc(void);
 void init_protocol_table(void);
 void init_selector_tables(void);
+void init_sync(void);
 void init_trampolines(void);
 void objc_send_load_message(Class class);
+#ifdef PREINITIALIZE_CLASSES
+void objc_preinitialize_loaded_classes(void);
+#endif
 
 void log_selector_memory_usage(void);
+void log_spinlock_contention(void);
+extern int spinlock_profiling;
+#ifdef LOCK_PROFILING
+void log_lock_profile(void);
+extern int lock_profiling;
+#endif
 void log_dtable_memory_usage(void);
+#ifndef ENABLE_GC
+void init_object_allocator(void);
+void log_object_allocator_stats(void);
+#endif
 
 static void log_memory_stats(void)
 {
   log_selector_memory_usage();
   log_dtable_memory_usage();
+#ifndef ENABLE_GC
+  log_object_allocator_stats();
+#endif
 }
 
 /* Number of threads that are alive.  */
@@ -58,6 +76,8 @@ void __objc_exec_class(struct objc_module_abi_8 *module)
   {
 #if ENABLE_GC
     init_gc();
+#else
+    init_object_allocator();
 #endif
     // Create the main runtime lock.  This is not safe in theory, but in
     // practice the first time that this function is called will be in the
@@ -77,12 +97,26 @@ void __objc_exec_class(struct objc_module_abi_8 *module)
     init_dispatch_tables();
     init_alias_table();
     init_arc();
+    init_associations();
+    init_sync();
     init_trampolines();
     first_run = NO;
     if (getenv("LIBOBJC_MEMORY_PROFILE"))
     {
       atexit(log_memory_stats);
     }
+    if (getenv("LIBOBJC_SPINLOCK_PROFILE"))
+    {
+      spinlock_profiling = 1;
+      atexit(log_spinlock_contention);
+    }
+#ifdef LOCK_PROFILING
+    if (getenv("LIBOBJC_LOCK_PROFILE"))
+    {
+      lock_profiling = 1;
+      atexit(log_lock_profile);
+    }
+#endif
     if (dispatch_begin_thread_4GC != 0) {
       dispatch_begin_thread_4GC = objc_registerThreadWithCollector;
     }
@@ -128,8 +162,8 @@ void __objc_exec_class(struct objc_module_abi_8 *module)
     objc_init_statics(*(statics++));
   }
 
-  // Load categories and statics that were deferred.
-  objc_load_buffered_categories();
+  // Load statics that were deferred.  Deferred categories are attached when
+  // their classes are loaded.
   objc_init_buffered_statics();
   // Fix up the class links for loaded classes.
   objc_resolve_class_links();
@@ -144,4 +178,9 @@ void __objc_exec_class(struct objc_module_abi_8 *module)
       objc_send_load_message(class);
     }
   }
+#ifdef PREINITIALIZE_CLASSES
+  // Classes from this module now have their +load methods and categories, so
+  // it is known which ones have +initialize methods.
+  objc_preinitialize_loaded_classes();
+#endif
 }
@@ -39,16 +39,23 @@ void objc_load_class(struct objc_class *class);
  * subsequently been loaded.
  */
 void objc_resolve_class_links(void);
+/**
+ * Resolves the classes that could not be resolved because no class with the
+ * name of their superclass had been loaded.  Called when a class becomes
+ * visible under a new name.
+ */
+void objc_resolve_waiting_classes(const char *name);
 /**
  * Attaches a category to its class, if the class is already loaded.  Buffers
  * it for future resolution if not.
  */
 void objc_try_load_category(struct objc_category *cat);
 /**
- * Tries to load all of the categories that could not previously be loaded
- * because their classes were not yet loaded.
+ * Attaches the categories that could not previously be loaded because no
+ * class with the specified name had been loaded.  Called when a class
+ * becomes visible under a new name.
  */
-void objc_load_buffered_categories(void);
+void objc_load_categories_for_class(Class cls, const char *name);
 /**
  * Updates the dispatch table for a class.
  */
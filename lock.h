@@ -11,8 +11,9 @@
 # include <windows.h>
 #undef BOOL
 typedef HANDLE mutex_t;
-# define INIT_LOCK(x) x = CreateMutex(NULL, FALSE, NULL)
-# define LOCK(x) WaitForSingleObject(*x, INFINITE)
+# define INIT_LOCK_UNPROFILED(x) x = CreateMutex(NULL, FALSE, NULL)
+# define LOCK_UNPROFILED(x) WaitForSingleObject(*x, INFINITE)
+# define TRYLOCK(x) (WaitForSingleObject(*x, 0) == WAIT_OBJECT_0)
 # define UNLOCK(x) ReleaseMutex(*x)
 # define DESTROY_LOCK(x) CloseHandle(*x)
 #else
@@ -23,11 +24,11 @@ typedef pthread_mutex_t mutex_t;
 // If this pthread implementation has a static initializer for recursive
 // mutexes, use that, otherwise fall back to the portable version
 # ifdef PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP
-#   define INIT_LOCK(x) x = (pthread_mutex_t)PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP
+#   define INIT_LOCK_UNPROFILED(x) x = (pthread_mutex_t)PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP
 # elif defined(PTHREAD_RECURSIVE_MUTEX_INITIALIZER)
-#   define INIT_LOCK(x) x = (pthread_mutex_t)PTHREAD_RECURSIVE_MUTEX_INITIALIZER
+#   define INIT_LOCK_UNPROFILED(x) x = (pthread_mutex_t)PTHREAD_RECURSIVE_MUTEX_INITIALIZER
 # else
-#   define INIT_LOCK(x) init_recursive_mutex(&(x))
+#   define INIT_LOCK_UNPROFILED(x) init_recursive_mutex(&(x))
 
 static inline void init_recursive_mutex(pthread_mutex_t *x)
 {
@@ -39,11 +40,30 @@ static inline void init_recursive_mutex(pthread_mutex_t *x)
 }
 # endif
 
-# define LOCK(x) pthread_mutex_lock(x)
+# define LOCK_UNPROFILED(x) pthread_mutex_lock(x)
+# define TRYLOCK(x) (0 == pthread_mutex_trylock(x))
 # define UNLOCK(x) pthread_mutex_unlock(x)
 # define DESTROY_LOCK(x) pthread_mutex_destroy(x)
 #endif
 
+#ifdef LOCK_PROFILING
+/**
+ * Acquires a lock.  If LIBOBJC_LOCK_PROFILE is set, then the acquisition and
+ * the time spent waiting are recorded against the lock and the call site.
+ */
+void lock_profiled(mutex_t *lock, const char *file, int line);
+/**
+ * Records the name of a lock, for the profile.
+ */
+void lock_profile_register(mutex_t *lock, const char *name);
+# define LOCK(x) lock_profiled(x, __FILE__, __LINE__)
+# define INIT_LOCK(x) do { INIT_LOCK_UNPROFILED(x);\
+  lock_profile_register(&(x), #x); } while (0)
+#else
+# define LOCK(x) LOCK_UNPROFILED(x)
+# define INIT_LOCK(x) INIT_LOCK_UNPROFILED(x)
+#endif
+
 __attribute__((unused)) static void objc_release_lock(void *x)
 {
   mutex_t *lock = *(mutex_t**)x;
@@ -0,0 +1,223 @@
+/**
+ * Lock contention profiling.  When the runtime is built with LOCK_PROFILING,
+ * every LOCK() goes through lock_profiled().  If the LIBOBJC_LOCK_PROFILE
+ * environment variable is set, then this records, for each lock, the number
+ * of acquisitions, how many of them had to wait, a histogram of wait times,
+ * and the call sites that acquired it.  The profile is printed at exit.
+ *
+ * The statistics for a lock are only modified while holding that lock, so
+ * recording them does not need any atomic operations.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include "lock.h"
+#include "visibility.h"
+
+#ifdef LOCK_PROFILING
+
+/**
+ * Number of locks that can be profiled.  Must be a power of two.
+ */
+#define LOCK_PROFILE_LOCKS 512
+/**
+ * Number of call sites recorded per lock.
+ */
+#define LOCK_PROFILE_SITES 8
+/**
+ * Number of wait time histogram buckets.  Bucket n counts waits of between
+ * 2^n and 2^(n+1) nanoseconds.
+ */
+#define LOCK_PROFILE_BUCKETS 40
+
+struct lock_site
+{
+  const char *file;
+  int line;
+  uint64_t acquisitions;
+  uint64_t wait_ns;
+};
+
+struct lock_profile
+{
+  /**
+   * The lock, or NULL if this entry is unused.
+   */
+  mutex_t *lock;
+  /**
+   * The name passed to INIT_LOCK(), or NULL if the lock was not initialised
+   * with it.
+   */
+  const char *name;
+  uint64_t acquisitions;
+  uint64_t contended;
+  uint64_t wait_ns;
+  uint64_t histogram[LOCK_PROFILE_BUCKETS];
+  struct lock_site sites[LOCK_PROFILE_SITES];
+  /**
+   * Acquisitions from call sites that did not fit in sites.
+   */
+  uint64_t other_sites;
+};
+
+static struct lock_profile lock_profiles[LOCK_PROFILE_LOCKS];
+
+PRIVATE int lock_profiling;
+
+/**
+ * Returns the profile entry for a lock, creating it if necessary, or NULL if
+ * the table is full.  Entries are never removed, so this does not need a
+ * lock.
+ */
+static struct lock_profile *profile_for_lock(mutex_t *lock)
+{
+  uint32_t hash = (uint32_t)(((uintptr_t)lock >> 4) * 2654435761U);
+  for (int i=0 ; i<LOCK_PROFILE_LOCKS ; i++)
+  {
+    struct lock_profile *p =
+      &lock_profiles[(hash + i) & (LOCK_PROFILE_LOCKS - 1)];
+    mutex_t *existing = p->lock;
+    if (existing == lock)
+    {
+      return p;
+    }
+    if ((NULL == existing) && __sync_bool_compare_and_swap(&p->lock, NULL, lock))
+    {
+      return p;
+    }
+    if (p->lock == lock)
+    {
+      return p;
+    }
+  }
+  return NULL;
+}
+
+static inline uint64_t now_ns(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t)t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+PRIVATE void lock_profile_register(mutex_t *lock, const char *name)
+{
+  struct lock_profile *p = profile_for_lock(lock);
+  if (NULL != p)
+  {
+    p->name = name;
+  }
+}
+
+static void record_site(struct lock_profile *p, const char *file, int line,
+                        uint64_t wait)
+{
+  for (int i=0 ; i<LOCK_PROFILE_SITES ; i++)
+  {
+    struct lock_site *site = &p->sites[i];
+    if (NULL == site->file)
+    {
+      site->file = file;
+      site->line = line;
+    }
+    if ((site->file == file) && (site->line == line))
+    {
+      site->acquisitions++;
+      site->wait_ns += wait;
+      return;
+    }
+  }
+  p->other_sites++;
+}
+
+PRIVATE void lock_profiled(mutex_t *lock, const char *file, int line)
+{
+  if (!lock_profiling)
+  {
+    LOCK_UNPROFILED(lock);
+    return;
+  }
+  uint64_t wait = 0;
+  if (!TRYLOCK(lock))
+  {
+    uint64_t start = now_ns();
+    LOCK_UNPROFILED(lock);
+    wait = now_ns() - start;
+  }
+  // We now hold the lock, so nothing else can modify its profile.
+  struct lock_profile *p = profile_for_lock(lock);
+  if (NULL == p) { return; }
+  p->acquisitions++;
+  if (wait > 0)
+  {
+    int bucket = 63 - __builtin_clzll(wait);
+    if (bucket >= LOCK_PROFILE_BUCKETS)
+    {
+      bucket = LOCK_PROFILE_BUCKETS - 1;
+    }
+    p->contended++;
+    p->wait_ns += wait;
+    p->histogram[bucket]++;
+  }
+  record_site(p, file, line, wait);
+}
+
+PRIVATE void log_lock_profile(void)
+{
+  for (int i=0 ; i<LOCK_PROFILE_LOCKS ; i++)
+  {
+    struct lock_profile *p = &lock_profiles[i];
+    if ((NULL == p->lock) || (0 == p->acquisitions))
+    {
+      continue;
+    }
+    if (NULL != p->name)
+    {
+      fprintf(stderr, "lock %s (%p)", p->name, (void*)p->lock);
+    }
+    else
+    {
+      fprintf(stderr, "lock %p", (void*)p->lock);
+    }
+    fprintf(stderr, ": %llu acquisitions, %llu contended, %lluns waiting\n",
+        (unsigned long long)p->acquisitions,
+        (unsigned long long)p->contended,
+        (unsigned long long)p->wait_ns);
+    for (int b=0 ; b<LOCK_PROFILE_BUCKETS ; b++)
+    {
+      if (0 != p->histogram[b])
+      {
+        fprintf(stderr, "  waited >= %lluns: %llu\n", 1ULL << b,
+            (unsigned long long)p->histogram[b]);
+      }
+    }
+    // Print the call sites, most waited-for first.
+    struct lock_site sites[LOCK_PROFILE_SITES];
+    int count = 0;
+    for (int s=0 ; (s<LOCK_PROFILE_SITES) && (NULL != p->sites[s].file) ; s++)
+    {
+      int j = count++;
+      while ((j > 0) && (sites[j-1].wait_ns < p->sites[s].wait_ns))
+      {
+        sites[j] = sites[j-1];
+        j--;
+      }
+      sites[j] = p->sites[s];
+    }
+    for (int s=0 ; s<count ; s++)
+    {
+      fprintf(stderr, "  %s:%d: %llu acquisitions, %lluns waiting\n",
+          sites[s].file, sites[s].line,
+          (unsigned long long)sites[s].acquisitions,
+          (unsigned long long)sites[s].wait_ns);
+    }
+    if (0 != p->other_sites)
+    {
+      fprintf(stderr, "  other call sites: %llu acquisitions\n",
+          (unsigned long long)p->other_sites);
+    }
+  }
+}
+
+#endif
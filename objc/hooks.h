@@ -77,6 +77,15 @@ extern struct objc_slot* (*_objc_selector_type_mismatch)(Class cls,
  */
 OBJC_HOOK id (*_objc_weak_load)(id object);
 
+/**
+ * Object allocation hook.  If this is set, then it is called with the class
+ * and the number of extra bytes before the runtime allocates memory for an
+ * object.  If it returns NO, then the allocation fails, as if the allocator
+ * had run out of memory.  This can be used to test how allocation failures
+ * are handled.
+ */
+OBJC_HOOK BOOL (*_objc_allocation_hook)(Class cls, size_t extraBytes);
+
 /**
  * Type for a tracing hook.  These are registered to be called before and after
  * each message send.  The parameters are the receiver and selector for the
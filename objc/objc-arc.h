@@ -72,6 +72,23 @@ void *objc_autoreleasePoolPush(void);
  * to every object that has been autreleased since the pool was created.
  */
 void objc_autoreleasePoolPop(void *pool);
+/**
+ * Pushes an autorelease pool and starts a region on the current thread.
+ * Until the region is popped, objects that this thread allocates with
+ * class_createInstance() come from memory that belongs to the region, and
+ * object_dispose() does not free it.
+ *
+ * Returns a value to pass to objc_region_pop().  Regions nest, like
+ * autorelease pools.
+ */
+void *objc_region_push(void);
+/**
+ * Pops the autorelease pool pushed by objc_region_push(), deallocating the
+ * objects in it as normal, and then frees all of the memory in the region,
+ * and in any regions pushed after it that have not been popped.  Every
+ * object allocated in the region must have been deallocated by this point.
+ */
+void objc_region_pop(void *region);
 /**
  * Initializes dest as a weak pointer and stores the value stored in src into
  * it.  
@@ -97,6 +114,14 @@ void objc_release(id obj);
  * Nonstandard extension.
  */
 void objc_delete_weak_refs(id obj);
+/**
+ * Returns the number of references to an object whose reference count is
+ * managed by the runtime, including any part of the count held in the side
+ * table, or 0 for other objects.
+ *
+ * Nonstandard extension.
+ */
+unsigned long object_getRetainCount_np(id obj);
 /**
  * Returns the total number of objects in the ARC-managed autorelease pool.
  */
@@ -276,6 +276,16 @@ Protocol *__unsafe_unretained* class_copyProtocolList(Class cls, unsigned int *o
  */
 id class_createInstance(Class cls, size_t extraBytes);
 
+/**
+ * Creates count instances of this class, storing them in the results array.
+ * This is equivalent to calling class_createInstance() count times, but does
+ * the per-class work once and may allocate the objects together.  Returns
+ * the number of objects created, which is less than count if memory runs
+ * out.  Each object must be freed with object_dispose().
+ */
+unsigned class_createInstances(Class cls, size_t extraBytes, id *results,
+                               unsigned count);
+
 /**
  * Returns a pointer to the method metadata for the specified method in this
  * class.  This is an opaque data type and must be accessed with the method_*()
@@ -13,13 +13,103 @@
 #include "gc_ops.h"
 #include "lock.h"
 
-PRIVATE int spinlocks[spinlock_count];
+PRIVATE struct spinlock_stripe spinlocks[spinlock_count];
+PRIVATE int spinlock_profiling;
+
+/**
+ * Number of stripes listed by log_spinlock_contention().
+ */
+#define SPINLOCK_PROFILE_TOP 16
+
+/**
+ * Prints the stripes that threads most often had to wait for.
+ */
+PRIVATE void log_spinlock_contention(void)
+{
+	unsigned long long total = 0;
+	int top[SPINLOCK_PROFILE_TOP];
+	int found = 0;
+	for (int i=0 ; i<spinlock_count ; i++)
+	{
+		unsigned count = spinlocks[i].contended;
+		total += count;
+		if ((0 == count) ||
+		    ((SPINLOCK_PROFILE_TOP == found) &&
+		     (count <= spinlocks[top[found-1]].contended)))
+		{
+			continue;
+		}
+		int j = (found < SPINLOCK_PROFILE_TOP) ? found++ : found - 1;
+		while ((j > 0) && (spinlocks[top[j-1]].contended < count))
+		{
+			top[j] = top[j-1];
+			j--;
+		}
+		top[j] = i;
+	}
+	fprintf(stderr, "%llu contended spinlock acquisitions (%d stripes)\n",
+			total, spinlock_count);
+	for (int i=0 ; i<found ; i++)
+	{
+		fprintf(stderr, "%u stripe %d\n", spinlocks[top[i]].contended, top[i]);
+	}
+}
 
 static inline BOOL checkAttribute(char field, int attr)
 {
 	return (field & attr) == attr;
 }
 
+/**
+ * Loads and retains the value of an atomic object property.
+ *
+ * Fast-ARC objects are loaded without taking the lock.  The reader registers
+ * in the stripe's epoch, so setters will not release the old value until we
+ * have retained it.  Other objects may run arbitrary code in -retain, so they
+ * are retained with the lock held.
+ */
+static inline id atomicLoadRetained(id *addr)
+{
+	struct spinlock_stripe *stripe = stripe_for_pointer(addr);
+	uintptr_t epoch = epoch_enter(&stripe->readers);
+	id ret = *(id volatile*)addr;
+	if ((nil == ret) || isSmallObject(ret) ||
+	    objc_test_class_flag(classForObject(ret), objc_class_flag_fast_arc))
+	{
+		ret = objc_retain(ret);
+		epoch_exit(&stripe->readers, epoch);
+		return ret;
+	}
+	epoch_exit(&stripe->readers, epoch);
+	lock_spinlock(&stripe->lock);
+	ret = objc_retain(*addr);
+	unlock_spinlock(&stripe->lock);
+	return ret;
+}
+
+/**
+ * Stores a new (already retained) value in an atomic object property and
+ * releases the old value.
+ *
+ * The store is an atomic exchange.  The old value is released only once no
+ * getter can still be about to retain it: lock-free getters are waited for
+ * through the stripe's epoch, and getters that hold the lock are waited for by
+ * acquiring it.  Taking the lock also serialises waiting setters, which the
+ * epoch requires.
+ */
+static inline void atomicStoreAndRelease(id *addr, id value)
+{
+	// Make sure that the new value is visible before its address is.
+	__sync_synchronize();
+	id old = __sync_lock_test_and_set(addr, value);
+	if (nil == old) { return; }
+	struct spinlock_stripe *stripe = stripe_for_pointer(addr);
+	lock_spinlock(&stripe->lock);
+	epoch_synchronize(&stripe->readers);
+	unlock_spinlock(&stripe->lock);
+	objc_release(old);
+}
+
 /**
  * Public function for getting a property.
  */
@@ -35,11 +125,7 @@ id objc_getProperty(id obj, SEL _cmd, ptrdiff_t offset, BOOL isAtomic)
 	id ret;
 	if (isAtomic)
 	{
-		volatile int *lock = lock_for_pointer(addr);
-		lock_spinlock(lock);
-		ret = *(id*)addr;
-		ret = objc_retain(ret);
-		unlock_spinlock(lock);
+		ret = atomicLoadRetained((id*)addr);
 		ret = objc_autoreleaseReturnValue(ret);
 	}
 	else
@@ -73,20 +159,13 @@ void objc_setProperty(id obj, SEL _cmd, ptrdiff_t offset, id arg, BOOL isAtomic,
 	{
 		arg = objc_retain(arg);
 	}
-	id old;
 	if (isAtomic)
 	{
-		volatile int *lock = lock_for_pointer(addr);
-		lock_spinlock(lock);
-		old = *(id*)addr;
-		*(id*)addr = arg;
-		unlock_spinlock(lock);
-	}
-	else
-	{
-		old = *(id*)addr;
-		*(id*)addr = arg;
+		atomicStoreAndRelease((id*)addr, arg);
+		return;
 	}
+	id old = *(id*)addr;
+	*(id*)addr = arg;
 	objc_release(old);
 }
 
@@ -94,13 +173,7 @@ void objc_setProperty_atomic(id obj, SEL _cmd, id arg, ptrdiff_t offset)
 {
 	char *addr = (char*)obj;
 	addr += offset;
-	arg = objc_retain(arg);
-	volatile int *lock = lock_for_pointer(addr);
-	lock_spinlock(lock);
-	id old = *(id*)addr;
-	*(id*)addr = arg;
-	unlock_spinlock(lock);
-	objc_release(old);
+	atomicStoreAndRelease((id*)addr, objc_retain(arg));
 }
 
 void objc_setProperty_atomic_copy(id obj, SEL _cmd, id arg, ptrdiff_t offset)
@@ -108,13 +181,7 @@ void objc_setProperty_atomic_copy(id obj, SEL _cmd, id arg, ptrdiff_t offset)
 	char *addr = (char*)obj;
 	addr += offset;
 
-	arg = [arg copy];
-	volatile int *lock = lock_for_pointer(addr);
-	lock_spinlock(lock);
-	id old = *(id*)addr;
-	*(id*)addr = arg;
-	unlock_spinlock(lock);
-	objc_release(old);
+	atomicStoreAndRelease((id*)addr, [arg copy]);
 }
 
 void objc_setProperty_nonatomic(id obj, SEL _cmd, id arg, ptrdiff_t offset)
@@ -139,13 +206,28 @@ void objc_setProperty_nonatomic_copy(id obj, SEL _cmd, id arg, ptrdiff_t offset)
 void objc_copyCppObjectAtomic(void *dest, const void *src,
                               void (*copyHelper) (void *dest, const void *source))
 {
-	volatile int *lock = lock_for_pointer(src < dest ? src : dest);
-	volatile int *lock2 = lock_for_pointer(src < dest ? dest : src);
-	lock_spinlock(lock);
-	lock_spinlock(lock2);
+	// Locks are taken in stripe order, so that two copies in opposite
+	// directions can't deadlock, and only once if both pointers share a
+	// stripe.
+	struct spinlock_stripe *first = stripe_for_pointer(src);
+	struct spinlock_stripe *second = stripe_for_pointer(dest);
+	if (second < first)
+	{
+		struct spinlock_stripe *tmp = first;
+		first = second;
+		second = tmp;
+	}
+	lock_spinlock(&first->lock);
+	if (second != first)
+	{
+		lock_spinlock(&second->lock);
+	}
 	copyHelper(dest, src);
-	unlock_spinlock(lock);
-	unlock_spinlock(lock2);
+	if (second != first)
+	{
+		unlock_spinlock(&second->lock);
+	}
+	unlock_spinlock(&first->lock);
 }
 
 void objc_getCppObjectAtomic(void *dest, const void *src,
@@ -166,6 +248,100 @@ void objc_setCppObjectAtomic(void *dest, const void *src,
 	unlock_spinlock(lock);
 }
 
+/**
+ * Copies a structure.  Common structure sizes are copied with a fixed-size
+ * memcpy(), which the compiler expands to a few loads and stores.
+ */
+static inline void copyStruct(void *dest, const void *src, ptrdiff_t size)
+{
+	switch (size)
+	{
+		case 8:
+			memcpy(dest, src, 8);
+			break;
+		case 16:
+			memcpy(dest, src, 16);
+			break;
+		case 24:
+			memcpy(dest, src, 24);
+			break;
+		case 32:
+			memcpy(dest, src, 32);
+			break;
+		default:
+			memcpy(dest, src, size);
+	}
+}
+
+/**
+ * Number of times that a structure read retries without the lock before
+ * waiting for the writer.
+ */
+static const int struct_read_attempts = 64;
+
+/**
+ * Reads an atomic structure property without taking the lock.  The copy is
+ * retried if a writer modified the structure while it was being copied.
+ */
+static inline void readStruct(void *dest, const void *src, ptrdiff_t size)
+{
+	struct spinlock_stripe *stripe = stripe_for_pointer(src);
+	for (int i=0 ; i<struct_read_attempts ; i++)
+	{
+		unsigned sequence = __atomic_load_n(&stripe->sequence, __ATOMIC_ACQUIRE);
+		if (0 == (sequence & 1))
+		{
+			copyStruct(dest, src, size);
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (sequence == __atomic_load_n(&stripe->sequence, __ATOMIC_RELAXED))
+			{
+				return;
+			}
+		}
+		spinlock_pause();
+	}
+	lock_spinlock(&stripe->lock);
+	copyStruct(dest, src, size);
+	unlock_spinlock(&stripe->lock);
+}
+
+/**
+ * Marks the start of a write to a structure protected by a stripe.  Must be
+ * called with the stripe locked.
+ */
+static inline void beginStructWrite(struct spinlock_stripe *stripe)
+{
+	__atomic_store_n(&stripe->sequence, stripe->sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/**
+ * Marks the end of a write to a structure protected by a stripe.
+ */
+static inline void endStructWrite(struct spinlock_stripe *stripe)
+{
+	__atomic_store_n(&stripe->sequence, stripe->sequence + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Writes an atomic structure property.  Writers are serialised by the lock.
+ */
+static inline void writeStruct(void *dest, const void *src, ptrdiff_t size)
+{
+	struct spinlock_stripe *stripe = stripe_for_pointer(dest);
+	lock_spinlock(&stripe->lock);
+	beginStructWrite(stripe);
+	copyStruct(dest, src, size);
+	endStructWrite(stripe);
+	unlock_spinlock(&stripe->lock);
+}
+
+/**
+ * Largest structure that objc_copyPropertyStruct() copies through a buffer on
+ * the stack when the source and destination use different stripes.
+ */
+#define STRUCT_COPY_BUFFER_SIZE 256
+
 /**
  * Structure copy function.  This is provided for compatibility with the Apple
  * APIs (it's an ABI function, so it's semi-public), but it's a bad design so
@@ -181,13 +357,40 @@ void objc_copyPropertyStruct(void *dest,
 {
 	if (atomic)
 	{
-		volatile int *lock = lock_for_pointer(src < dest ? src : dest);
-		volatile int *lock2 = lock_for_pointer(src < dest ? dest : src);
-		lock_spinlock(lock);
-		lock_spinlock(lock2);
-		memcpy(dest, src, size);
-		unlock_spinlock(lock);
-		unlock_spinlock(lock2);
+		// Either pointer may be the ivar, so treat dest as being written and
+		// src as being read.  Reading small structures into a temporary first
+		// means that we never wait for one stripe while holding another's
+		// lock.
+		struct spinlock_stripe *stripe = stripe_for_pointer(dest);
+		struct spinlock_stripe *srcStripe = stripe_for_pointer(src);
+		if ((srcStripe != stripe) && (size <= STRUCT_COPY_BUFFER_SIZE))
+		{
+			char buffer[STRUCT_COPY_BUFFER_SIZE];
+			readStruct(buffer, src, size);
+			writeStruct(dest, buffer, size);
+		}
+		else
+		{
+			// Structures that are too big for the buffer are copied with both
+			// locks held, taken in address order.
+			struct spinlock_stripe *first =
+				(srcStripe < stripe) ? srcStripe : stripe;
+			struct spinlock_stripe *second =
+				(srcStripe < stripe) ? stripe : srcStripe;
+			lock_spinlock(&first->lock);
+			if (second != first)
+			{
+				lock_spinlock(&second->lock);
+			}
+			beginStructWrite(stripe);
+			copyStruct(dest, src, size);
+			endStructWrite(stripe);
+			if (second != first)
+			{
+				unlock_spinlock(&second->lock);
+			}
+			unlock_spinlock(&first->lock);
+		}
 	}
 	else
 	{
@@ -197,7 +400,8 @@ void objc_copyPropertyStruct(void *dest,
 
 /**
  * Get property structure function.  Copies a structure from an ivar to another
- * variable.  Locks on the address of src.
+ * variable.  Atomic reads do not take a lock unless a writer to the same
+ * stripe keeps interrupting them.
  */
 void objc_getPropertyStruct(void *dest,
                             void *src,
@@ -207,10 +411,7 @@ void objc_getPropertyStruct(void *dest,
 {
 	if (atomic)
 	{
-		volatile int *lock = lock_for_pointer(src);
-		lock_spinlock(lock);
-		memcpy(dest, src, size);
-		unlock_spinlock(lock);
+		readStruct(dest, src, size);
 	}
 	else
 	{
@@ -230,10 +431,7 @@ void objc_setPropertyStruct(void *dest,
 {
 	if (atomic)
 	{
-		volatile int *lock = lock_for_pointer(dest);
-		lock_spinlock(lock);
-		memcpy(dest, src, size);
-		unlock_spinlock(lock);
+		writeStruct(dest, src, size);
 	}
 	else
 	{
@@ -0,0 +1,186 @@
+/**
+ * The header that the runtime stores in front of objects whose classes use
+ * the fast ARC path (objc_class_flag_fast_arc).
+ *
+ * The word immediately before the object is the reference count word.  The
+ * low bits hold the number of references minus one, so a freshly allocated
+ * (zeroed) object has one reference.  The high bits are flags:
+ *
+ *  - refcount_weak_slot: the word before the reference count is an inline
+ *    weak reference slot.  Set by the allocator.
+ *  - refcount_weakly_referenced: a weak reference to the object has been
+ *    stored at some point.  If this is clear, then there is nothing in the
+ *    weak reference table for the object.
+ *  - refcount_has_assoc: the object has (or had) associated objects.  If this
+ *    is clear, then the object has no hidden class.
+ *  - refcount_deallocating: the last reference has been released and the
+ *    object must not be retained again.
+ *  - refcount_overflow: part of the count is stored in a side table.
+ *
+ * The flags are set once and never cleared, except for the overflow flag.
+ * Counts that do not fit in the count field are saturated: half of the count
+ * is moved into the side table when the field is full and moved back when it
+ * reaches zero.
+ *
+ * When the runtime's own allocator created the object and INLINE_WEAK_REFS is
+ * defined, the word before the reference count holds the address of one weak
+ * reference to the object, so that objects with a single weak referrer do not
+ * need an entry in the weak reference table.  Objects from other allocators
+ * do not have this word, so it may only be accessed if refcount_weak_slot is
+ * set.
+ */
+#ifndef __LIBOBJC_REFCOUNT_H_INCLUDED__
+#define __LIBOBJC_REFCOUNT_H_INCLUDED__
+#include <stdint.h>
+#include "visibility.h"
+
+#ifdef INLINE_WEAK_REFS
+#  define OBJECT_HEADER_WORDS 2
+#else
+#  define OBJECT_HEADER_WORDS 1
+#endif
+/**
+ * Number of bytes that the runtime's allocator places in front of objects.
+ */
+#define OBJECT_HEADER_SIZE (OBJECT_HEADER_WORDS * sizeof(uintptr_t))
+
+#define REFCOUNT_FLAG(x) (((uintptr_t)1) << (sizeof(uintptr_t) * 8 - (x)))
+
+static const uintptr_t refcount_weak_slot = REFCOUNT_FLAG(1);
+static const uintptr_t refcount_weakly_referenced = REFCOUNT_FLAG(2);
+static const uintptr_t refcount_has_assoc = REFCOUNT_FLAG(3);
+static const uintptr_t refcount_deallocating = REFCOUNT_FLAG(4);
+static const uintptr_t refcount_overflow = REFCOUNT_FLAG(5);
+/**
+ * Mask for the count field.  Builds that test the overflow side table define
+ * REFCOUNT_BITS to make the field narrower.
+ */
+#ifdef REFCOUNT_BITS
+static const uintptr_t refcount_mask = (((uintptr_t)1) << REFCOUNT_BITS) - 1;
+#else
+static const uintptr_t refcount_mask = REFCOUNT_FLAG(5) - 1;
+#endif
+
+/**
+ * Adds one to a reference count whose count field is full, moving half of the
+ * count into the side table.  Returns NO if the object is being deallocated.
+ */
+PRIVATE BOOL refcount_overflow_increment(uintptr_t *refCount);
+/**
+ * Subtracts one from a reference count whose count field is zero and that
+ * has part of its count in the side table.  Returns YES if this released the
+ * last reference.
+ */
+PRIVATE BOOL refcount_overflow_decrement(uintptr_t *refCount);
+
+/**
+ * Returns the reference count word for an object.
+ */
+static inline uintptr_t *refcount_for_object(id obj)
+{
+  return ((uintptr_t*)obj) - 1;
+}
+
+/**
+ * Returns the inline weak reference slot for an object.  Only valid if the
+ * reference count word has the refcount_weak_slot flag set.
+ */
+static inline id **weak_slot_for_object(id obj)
+{
+  return (id**)(((uintptr_t*)obj) - 2);
+}
+
+static inline BOOL refcount_is_deallocating(uintptr_t refcount)
+{
+  return (refcount & refcount_deallocating) == refcount_deallocating;
+}
+
+/**
+ * Atomically increments the reference count, unless the object is already
+ * being deallocated.  Returns NO if the object is being deallocated.
+ */
+static inline BOOL refcount_increment(uintptr_t *refCount)
+{
+  uintptr_t count = *refCount;
+  for (;;)
+  {
+    if (refcount_is_deallocating(count))
+    {
+      return NO;
+    }
+    if (UNLIKELY((count & refcount_mask) == refcount_mask))
+    {
+      return refcount_overflow_increment(refCount);
+    }
+    uintptr_t old = __sync_val_compare_and_swap(refCount, count, count+1);
+    if (old == count)
+    {
+      return YES;
+    }
+    count = old;
+  }
+}
+
+/**
+ * Atomically decrements the reference count.  Returns YES if this released
+ * the last reference, in which case the object is now marked as deallocating
+ * and the caller must destroy it.  If flags is not NULL, then it is set to
+ * the flags in the reference count word at the time of the decrement.
+ */
+static inline BOOL refcount_decrement(uintptr_t *refCount, uintptr_t *flags)
+{
+  uintptr_t count = *refCount;
+  for (;;)
+  {
+    if (NULL != flags)
+    {
+      *flags = count & ~refcount_mask;
+    }
+    // Over-releasing an object that is already being deallocated is an
+    // error, but we should only deallocate once.
+    if (refcount_is_deallocating(count))
+    {
+      return NO;
+    }
+    BOOL isLast = (0 == (count & refcount_mask));
+    if (UNLIKELY(isLast && (count & refcount_overflow)))
+    {
+      return refcount_overflow_decrement(refCount);
+    }
+    uintptr_t newCount = isLast ? (count | refcount_deallocating) : count - 1;
+    uintptr_t old = __sync_val_compare_and_swap(refCount, count, newCount);
+    if (old == count)
+    {
+      return isLast;
+    }
+    count = old;
+  }
+}
+
+/**
+ * Atomically sets a flag in the reference count word, unless the object is
+ * being deallocated.  Returns NO if the object is being deallocated.
+ */
+static inline BOOL refcount_set_flag(uintptr_t *refCount, uintptr_t flag)
+{
+  uintptr_t count = *refCount;
+  for (;;)
+  {
+    if (refcount_is_deallocating(count))
+    {
+      return NO;
+    }
+    if (count & flag)
+    {
+      return YES;
+    }
+    uintptr_t old = __sync_val_compare_and_swap(refCount, count, count | flag);
+    if (old == count)
+    {
+      return YES;
+    }
+    count = old;
+  }
+}
+
+#endif // __LIBOBJC_REFCOUNT_H_INCLUDED__
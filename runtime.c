@@ -7,6 +7,7 @@
 #include "lock.h"
 #include "dtable.h"
 #include "gc_ops.h"
+#include "objc/hooks.h"
 
 /* Make glibc export strdup() */
 
@@ -22,6 +23,12 @@
 struct objc_slot *objc_get_slot(Class cls, SEL selector);
 #define CHECK_ARG(arg) if (0 == arg) { return 0; }
 
+void free_hidden_class(id obj);
+void objc_load_categories_for_class(Class cls, const char *name);
+#ifdef ASSOCIATION_SIDE_TABLE
+void free_side_table_associations(id obj);
+#endif
+
 /**
  * Calls C++ destructors in the correct order.
  */
@@ -34,41 +41,69 @@ PRIVATE void call_cxx_destruct(id obj)
   }
   // Don't call object_getClass(), because we want to get hidden classes too
   Class cls = classForObject(obj);
-
-  while (cls)
-  {
-    struct objc_slot *slot = objc_get_slot(cls, cxx_destruct);
-    cls = Nil;
-    if (NULL != slot)
+  // Hidden classes do not have destructors of their own.  The object's hidden
+  // class is freed, and a clone's prototype released, after the destructors
+  // for its real class have run.
+  BOOL hasHiddenClass =
+    objc_test_class_flag(cls, objc_class_flag_hidden_class) ||
+    objc_test_class_flag(cls, objc_class_flag_shared_overlay);
+
+  BOOL copied;
+  IMP *destruct = objc_cxx_destruct_methods(cls, &copied);
+  if (NULL != destruct)
+  {
+    for (IMP *d = destruct ; NULL != *d ; d++)
     {
-      cls = slot->owner->super_class;
-      slot->method(obj, cxx_destruct);
+      (*d)(obj, cxx_destruct);
+    }
+    if (copied)
+    {
+      free(destruct);
     }
   }
+#ifdef ASSOCIATION_SIDE_TABLE
+  // Associated objects are released after the object's own destructors.
+  free_side_table_associations(obj);
+#endif
+  if (hasHiddenClass)
+  {
+    free_hidden_class(obj);
+  }
 }
 
-static void call_cxx_construct_for_class(Class cls, id obj)
+/**
+ * Calls the C++ constructors for several objects of the same class, in the
+ * correct order for each object.
+ */
+static void call_cxx_construct_for_objects(Class cls, id *objs, unsigned count)
 {
   static SEL cxx_construct;
   if (NULL == cxx_construct)
   {
     cxx_construct = sel_registerName(".cxx_construct");
   }
-  struct objc_slot *slot = objc_get_slot(cls, cxx_construct);
-  if (NULL != slot)
+  BOOL copied;
+  IMP *construct = objc_cxx_construct_methods(cls, &copied);
+  if (NULL == construct)
+  {
+    return;
+  }
+  for (IMP *c = construct ; NULL != *c ; c++)
   {
-    cls = slot->owner->super_class;
-    if (Nil != cls)
+    for (unsigned i=0 ; i<count ; i++)
     {
-      call_cxx_construct_for_class(cls, obj);
+      (*c)(objs[i], cxx_construct);
     }
-    slot->method(obj, cxx_construct);
+  }
+  if (copied)
+  {
+    free(construct);
   }
 }
 
 PRIVATE void call_cxx_construct(id obj)
 {
-  call_cxx_construct_for_class(classForObject(obj), obj);
+  call_cxx_construct_for_objects(classForObject(obj), &obj, 1);
 }
 
 /**
@@ -330,9 +365,12 @@ Protocol*__unsafe_unretained* class_copyProtocolList(Class cls, unsigned int *ou
   return protocols;
 }
 
-id class_createInstance(Class cls, size_t extraBytes)
+/**
+ * Returns the small object for a small object class, or nil if cls is not
+ * one.
+ */
+static id small_object_for_class(Class cls)
 {
-  CHECK_ARG(cls);
   if (sizeof(id) == 4)
   {
     if (cls == SmallObjectClasses[0])
@@ -350,19 +388,82 @@ id class_createInstance(Class cls, size_t extraBytes)
       }
     }
   }
+  return nil;
+}
+
+/**
+ * Allocates memory for an object with the current allocator, or returns nil if
+ * the allocation fails.
+ */
+static inline id allocate_object(Class cls, size_t extraBytes)
+{
+  if ((NULL != _objc_allocation_hook) && !_objc_allocation_hook(cls, extraBytes))
+  {
+    return nil;
+  }
+  return gc->allocate_class(cls, extraBytes);
+}
+
+id class_createInstance(Class cls, size_t extraBytes)
+{
+  CHECK_ARG(cls);
+  id small = small_object_for_class(cls);
+  if (nil != small) { return small; }
 
   if (Nil == cls) { return nil; }
-  id obj = gc->allocate_class(cls, extraBytes);
-  obj->isa = cls;
+  // The allocator needs to know whether the object uses the fast ARC path.
+  // This only looks up methods the first time that it is called for a class.
   checkARCAccessors(cls);
+  id obj = allocate_object(cls, extraBytes);
+  if (nil == obj) { return nil; }
+  obj->isa = cls;
   call_cxx_construct(obj);
   return obj;
 }
 
+unsigned class_createInstances(Class cls, size_t extraBytes, id *results,
+                               unsigned count)
+{
+  CHECK_ARG(cls);
+  id small = small_object_for_class(cls);
+  if (nil != small)
+  {
+    for (unsigned i=0 ; i<count ; i++)
+    {
+      results[i] = small;
+    }
+    return count;
+  }
+  checkARCAccessors(cls);
+  unsigned allocated = 0;
+  // The allocation hook is called for each object, so it bypasses the batch
+  // allocator.
+  if ((NULL != gc->allocate_class_batch) && (NULL == _objc_allocation_hook))
+  {
+    allocated = gc->allocate_class_batch(cls, extraBytes, results, count);
+  }
+  else
+  {
+    for ( ; allocated<count ; allocated++)
+    {
+      id obj = allocate_object(cls, extraBytes);
+      if (nil == obj) { break; }
+      results[allocated] = obj;
+    }
+  }
+  for (unsigned i=0 ; i<allocated ; i++)
+  {
+    results[i]->isa = cls;
+  }
+  call_cxx_construct_for_objects(cls, results, allocated);
+  return allocated;
+}
+
 id object_copy(id obj, size_t size)
 {
   Class cls = object_getClass(obj);
   id cpy = class_createInstance(cls, size - class_getInstanceSize(cls));
+  if (nil == cpy) { return nil; }
   memcpy(((char*)cpy + sizeof(id)), ((char*)obj + sizeof(id)), size - sizeof(id));
   return cpy;
 }
@@ -645,6 +746,7 @@ void objc_disposeClassPair(Class cls)
     safe_remove_from_subclass_list(cls);
   }
 
+  objc_forget_cxx_methods(cls);
   // Free the method and ivar lists.
   freeMethodLists(cls);
   freeMethodLists(meta);
@@ -739,7 +841,9 @@ Class object_getClass(id obj)
 {
   CHECK_ARG(obj);
   Class isa = classForObject(obj);
-  while ((Nil != isa) && objc_test_class_flag(isa, objc_class_flag_hidden_class))
+  while ((Nil != isa) &&
+         (objc_test_class_flag(isa, objc_class_flag_hidden_class) ||
+          objc_test_class_flag(isa, objc_class_flag_shared_overlay)))
   {
     isa = isa->super_class;
   }
@@ -768,6 +872,7 @@ void objc_registerClassPair(Class cls)
 {
   LOCK_RUNTIME_FOR_SCOPE();
   class_table_insert(cls);
+  objc_load_categories_for_class(cls, cls->name);
   objc_resolve_class(cls);
 }
 
@@ -43,15 +43,24 @@ struct sel_dtable
   atomic_bool lock;
   uint8_t  next;
 #endif
+  /**
+   * Number of entries.  Stored with release ordering after the entry that it
+   * includes, so that lookups without the lock can read it with acquire.
+   */
   uint32_t size;
   uint32_t capacity;
   uint32_t index;
+  /**
+   * Set, with release ordering, once array has replaced slots.
+   */
   BOOL is_sparse;
-  union
-  {
-    struct objc_slot **slots;
-    SparseArray *array;
-  };
+  /**
+   * The entries, until there are too many to search linearly.  Not a union
+   * with array, because lookups that started before the switch may still be
+   * reading it.
+   */
+  struct objc_slot **slots;
+  SparseArray *array;
   struct sel_type_list type_list;
 };
 
@@ -75,7 +75,14 @@ Slot_t objc_msg_lookup_internal(id *receiver, SEL sel, id sender)
   if ((slot = dtable_lookup(dtable, cls)))
   {
 #if INV_DTABLE_SIZE != 0
-    if (spin_trylock(&dtable->lock))
+    // Hidden classes belong to a single object, so caching them would evict
+    // entries for shared classes, and the entries would have to be cleared
+    // when the object is destroyed.  Classes that are still running
+    // +initialize are not cached either, because other threads must not be
+    // able to send them messages until it has finished.
+    if (!objc_test_class_flag(cls, objc_class_flag_hidden_class) &&
+        is_initialised(cls) &&
+        spin_trylock(&dtable->lock))
     {
       struct sel_entry *entry = &dtable->entries[(dtable->next++) % INV_DTABLE_SIZE];
       entry->class = 0;
@@ -1,3 +1,5 @@
+#ifndef __LIBOBJC_SPINLOCK_H_INCLUDED__
+#define __LIBOBJC_SPINLOCK_H_INCLUDED__
 #ifdef __MINGW32__
 #include <windows.h>
 static unsigned sleep(unsigned seconds)
@@ -8,46 +10,167 @@ static unsigned sleep(unsigned seconds)
 #else
 #include <unistd.h>
 #endif
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#include <stddef.h>
+#include <stdint.h>
+#include "epoch.h"
 
+#ifndef SPINLOCK_STRIPE_BITS
+/**
+ * Log2 of the number of lock stripes.  Set with the SPINLOCK_STRIPE_BITS
+ * CMake option.
+ */
+#define SPINLOCK_STRIPE_BITS 10
+#endif
 /**
- * Number of spinlocks.  This allocates one page on 32-bit platforms.
+ * Number of spinlocks.
  */
-#define spinlock_count (1<<10)
-static const int spinlock_mask = spinlock_count - 1;
+#define spinlock_count (1<<SPINLOCK_STRIPE_BITS)
 /**
- * Integers used as spinlocks for atomic property access.
+ * A lock stripe.  Each lock has a cache line to itself, so that threads using
+ * unrelated locks do not contend on the same line.
  */
-extern int spinlocks[spinlock_count];
+struct spinlock_stripe
+{
+  /**
+   * The lock word.  0 means unlocked, 1 means locked, 2 means locked and
+   * there may be threads sleeping on the lock.
+   */
+  volatile int lock;
+  /**
+   * Sequence number for structure properties protected by this stripe.  It
+   * is odd while a writer holding the lock is modifying one, so readers can
+   * copy without the lock and retry if it changed.
+   */
+  unsigned sequence;
+  /**
+   * Number of times that a thread has had to wait for this lock.  Only
+   * updated when spinlock_profiling is set.
+   */
+  unsigned contended;
+  /**
+   * Readers that are accessing data protected by this stripe without holding
+   * the lock.  See epoch.h.
+   */
+  struct epoch readers;
+} __attribute__((aligned(64)));
+/**
+ * Lock stripes used for atomic property access.
+ */
+extern struct spinlock_stripe spinlocks[spinlock_count];
 /**
- * Get a spin lock from a pointer.  We want to prevent lock contention between
+ * Set if spinlock contention should be recorded, from the
+ * LIBOBJC_SPINLOCK_PROFILE environment variable.
+ */
+extern int spinlock_profiling;
+/**
+ * Get the lock stripe for a pointer.  We want to prevent lock contention between
  * properties in the same object - if someone is stupid enough to be using
  * atomic property access, they are probably stupid enough to do it for
  * multiple properties in the same object.  We also want to try to avoid
  * contention between the same property in different objects, so we can't just
  * use the ivar offset.
+ *
+ * The address, without the bits below pointer alignment, is multiplied by
+ * the golden ratio and the stripe taken from the top bits of the product, so
+ * adjacent ivars and the same ivar in different objects spread out over all
+ * of the stripes.
+ */
+static inline struct spinlock_stripe *stripe_for_pointer(const void *ptr)
+{
+  uintptr_t hash = (uintptr_t)ptr >> (sizeof(void*) == 4 ? 2 : 3);
+  if (sizeof(uintptr_t) == 8)
+  {
+    hash *= (uintptr_t)0x9E3779B97F4A7C15ULL;
+  }
+  else
+  {
+    hash *= (uintptr_t)0x9E3779B9U;
+  }
+  return &spinlocks[hash >> (sizeof(uintptr_t) * 8 - SPINLOCK_STRIPE_BITS)];
+}
+/**
+ * Get the lock word of the stripe for a pointer.
  */
 static inline volatile int *lock_for_pointer(const void *ptr)
 {
-  intptr_t hash = (intptr_t)ptr;
-  // Most properties will be pointers, so disregard the lowest few bits
-  hash >>= sizeof(void*) == 4 ? 2 : 8;
-  intptr_t low = hash & spinlock_mask;
-  hash >>= 16;
-  hash |= low;
-  return spinlocks + (hash & spinlock_mask);
+  return &stripe_for_pointer(ptr)->lock;
 }
 
 /**
- * Unlocks the spinlock.  This is not an atomic operation.  We are only ever
- * modifying the lowest bit of the spinlock word, so it doesn't matter if this
- * is two writes because there is no contention among the high bit.  There is
- * no possibility of contention among calls to this, because it may only be
- * called by the thread owning the spin lock.
+ * Number of times that lock_spinlock() retries with backoff before putting
+ * the thread to sleep.
+ */
+static const int spinlock_spin_limit = 16;
+/**
+ * Maximum number of pause instructions between attempts to take the lock.
+ */
+static const int spinlock_max_backoff = 64;
+
+/**
+ * Hint to the CPU that we are in a spin-wait loop.
+ */
+static inline void spinlock_pause(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+#ifdef __linux__
+/**
+ * Sleeps until the lock word is changed from value and a waker is called.
+ */
+static inline void spinlock_park(volatile int *spinlock, int value)
+{
+  syscall(SYS_futex, spinlock, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
+/**
+ * Wakes one thread sleeping on the lock.
+ */
+static inline void spinlock_unpark(volatile int *spinlock)
+{
+  syscall(SYS_futex, spinlock, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+#else
+// Without futexes, waiting threads just yield and try again.
+static inline void spinlock_park(volatile int *spinlock, int value)
+{
+  sleep(0);
+}
+static inline void spinlock_unpark(volatile int *spinlock) {}
+#endif
+
+/**
+ * Records that a thread had to wait for a spinlock.  All spinlocks are the
+ * lock word of a stripe.
+ */
+static inline void spinlock_record_contention(volatile int *spinlock)
+{
+  if (spinlock_profiling)
+  {
+    struct spinlock_stripe *stripe = (struct spinlock_stripe*)
+      ((char*)spinlock - offsetof(struct spinlock_stripe, lock));
+    __sync_fetch_and_add(&stripe->contended, 1);
+  }
+}
+
+/**
+ * Unlocks the spinlock.  If another thread has gone to sleep waiting for the
+ * lock, then this wakes it.  This may only be called by the thread owning the
+ * spin lock.
  */
 inline static void unlock_spinlock(volatile int *spinlock)
 {
-  __sync_synchronize();
-  *spinlock = 0;
+  if (2 == __sync_fetch_and_and(spinlock, 0))
+  {
+    spinlock_unpark(spinlock);
+  }
 }
 /**
  * Attempts to lock a spinlock.  This is heavily optimised for the uncontended
@@ -57,25 +180,40 @@ inline static void unlock_spinlock(volatile int *spinlock)
  * may require locking a cache line in a cache-coherent SMP system, but it's a
  * lot cheaper than a system call).
  *
- * If the lock is contended, then we just sleep and then try again after the
- * other threads have run.  Note that there is no upper bound on the potential
- * running time of this function, which is one of the great many reasons that
- * using atomic accessors is a terrible idea, but in the common case it should
- * be very fast.
+ * If the lock is contended, then we spin for a short while, backing off
+ * exponentially and only reading the lock word between attempts, in the hope
+ * that the owner will release it soon.  If it does not, then we mark the lock
+ * as contended and sleep until the owner wakes us.
  */
 inline static void lock_spinlock(volatile int *spinlock)
 {
-  int count = 0;
-  // Set the spin lock value to 1 if it is 0.
-  while(!__sync_bool_compare_and_swap(spinlock, 0, 1))
+  if (__sync_bool_compare_and_swap(spinlock, 0, 1))
+  {
+    return;
+  }
+  spinlock_record_contention(spinlock);
+  int delay = 1;
+  for (int i=0 ; i<spinlock_spin_limit ; i++)
   {
-    count++;
-    if (0 == count % 10)
+    for (int j=0 ; j<delay ; j++)
+    {
+      spinlock_pause();
+    }
+    if (delay < spinlock_max_backoff)
     {
-      // If it is already 1, let another thread play with the CPU for a
-      // bit then try again.
-      sleep(0);
+      delay <<= 1;
     }
+    if ((0 == *spinlock) && __sync_bool_compare_and_swap(spinlock, 0, 1))
+    {
+      return;
+    }
+  }
+  // We can't tell if there are other sleeping threads, so once we have slept
+  // we must leave the lock marked as contended.
+  while (0 != __sync_lock_test_and_set(spinlock, 2))
+  {
+    spinlock_park(spinlock, 2);
   }
 }
 
+#endif // __LIBOBJC_SPINLOCK_H_INCLUDED__
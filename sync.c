@@ -0,0 +1,248 @@
+#include <stdlib.h>
+#include <sched.h>
+#include "objc/runtime.h"
+#include "class.h"
+#include "lock.h"
+#include "visibility.h"
+
+/**
+ * Monitors for @synchronized.  Each object that is currently locked (or that
+ * a thread is waiting to lock) has a monitor in a table keyed by the
+ * object's address.  The table is split into stripes, each with its own
+ * mutex, so threads locking unrelated objects rarely contend.
+ *
+ * A monitor exists only while it is held or waited on, so there is nothing to
+ * clean up when an object is deallocated and locking an object never modifies
+ * it (in particular, it does not change its class).  Each monitor has a
+ * recursive mutex, which is kept when the monitor is reused.  The stripe lock
+ * is only held while looking up monitors, never while waiting for one.
+ *
+ * Most @synchronized blocks are not contended, so each stripe also has a thin
+ * lock, which one object at a time can hold without a monitor.  Taking it is
+ * a single compare-and-swap on a word containing the object, and its owner
+ * and depth are only modified by the thread that holds it.  A thread that
+ * finds the thin lock in use goes to the monitor table, and sets a flag in the
+ * thin lock word while the stripe has any monitors, so that the thin lock is
+ * not taken again until they are all gone.  If the object that it wants is
+ * the one in the thin lock, then it waits for the owner to release the thin
+ * lock before taking the monitor's lock: the object is inflated.
+ */
+struct monitor
+{
+  /** The object that this monitor locks. */
+  id object;
+  /**
+   * Number of threads that hold or are waiting for the monitor, counting each
+   * level of recursion.  Protected by the stripe lock.
+   */
+  unsigned int users;
+  /**
+   * Number of times that the owner has entered the monitor.  Protected by the
+   * monitor's lock.
+   */
+  unsigned int depth;
+  /** Set once the lock has been initialised. */
+  BOOL hasLock;
+  /** The lock that @synchronized holds. */
+  mutex_t lock;
+  /** Next monitor in the same stripe. */
+  struct monitor *next;
+};
+
+/**
+ * Number of stripes in the monitor table.  Must be a power of two.
+ */
+#define MONITOR_STRIPE_BITS 8
+#define MONITOR_STRIPES (1<<MONITOR_STRIPE_BITS)
+
+/**
+ * Flag set in a stripe's thin lock word while the stripe has monitors.
+ */
+#define THIN_LOCK_INFLATED ((uintptr_t)1)
+
+struct monitor_stripe
+{
+  /**
+   * The object that holds the thin lock, if any, combined with
+   * THIN_LOCK_INFLATED.
+   */
+  uintptr_t thin;
+  /** The thread that holds the thin lock.  Only set by that thread. */
+  void *thinOwner;
+  /** Number of times that the thin lock's owner has entered it. */
+  unsigned int thinDepth;
+  /** Lock protecting all of the monitors in this stripe. */
+  mutex_t lock;
+  /** Monitors that are currently held or waited on. */
+  struct monitor *monitors;
+  /** Unused monitors, kept for reuse. */
+  struct monitor *free;
+} __attribute__((aligned(64)));
+
+static struct monitor_stripe monitorStripes[MONITOR_STRIPES];
+
+/**
+ * A per-thread variable whose address identifies the thread that owns a thin
+ * lock.
+ */
+static __thread char threadIdentity;
+
+static inline BOOL ownsThinLock(struct monitor_stripe *stripe, id object)
+{
+  uintptr_t thin = __atomic_load_n(&stripe->thin, __ATOMIC_RELAXED);
+  return ((thin & ~THIN_LOCK_INFLATED) == (uintptr_t)object) &&
+    (__atomic_load_n(&stripe->thinOwner, __ATOMIC_RELAXED) == &threadIdentity);
+}
+
+PRIVATE void init_sync(void)
+{
+  for (int i=0 ; i<MONITOR_STRIPES ; i++)
+  {
+    INIT_LOCK(monitorStripes[i].lock);
+  }
+}
+
+static inline struct monitor_stripe *stripeForObject(id object)
+{
+  uint32_t hash = (uint32_t)((uintptr_t)object >> 4) * 2654435761U;
+  return &monitorStripes[hash >> (32 - MONITOR_STRIPE_BITS)];
+}
+
+static inline struct monitor *findMonitor(struct monitor_stripe *stripe,
+                                          id object)
+{
+  for (struct monitor *m = stripe->monitors ; NULL != m ; m = m->next)
+  {
+    if (m->object == object)
+    {
+      return m;
+    }
+  }
+  return NULL;
+}
+
+static inline struct monitor *addMonitor(struct monitor_stripe *stripe,
+                                         id object)
+{
+  struct monitor *m = stripe->free;
+  if (NULL != m)
+  {
+    stripe->free = m->next;
+  }
+  else
+  {
+    m = calloc(1, sizeof(struct monitor));
+  }
+  if (!m->hasLock)
+  {
+    INIT_LOCK(m->lock);
+    m->hasLock = YES;
+  }
+  m->object = object;
+  m->users = 0;
+  m->depth = 0;
+  m->next = stripe->monitors;
+  stripe->monitors = m;
+  return m;
+}
+
+static inline void removeMonitor(struct monitor_stripe *stripe,
+                                 struct monitor *monitor)
+{
+  struct monitor **prev = &stripe->monitors;
+  while (*prev != monitor)
+  {
+    prev = &(*prev)->next;
+  }
+  *prev = monitor->next;
+  if (NULL == stripe->monitors)
+  {
+    __atomic_fetch_and(&stripe->thin, ~THIN_LOCK_INFLATED, __ATOMIC_RELAXED);
+  }
+  // Keep the lock for the next user.
+  monitor->object = nil;
+  monitor->next = stripe->free;
+  stripe->free = monitor;
+}
+
+int objc_sync_enter(id object)
+{
+  if ((object == 0) || isSmallObject(object)) { return 0; }
+  struct monitor_stripe *stripe = stripeForObject(object);
+  uintptr_t unlocked = 0;
+  if (__atomic_compare_exchange_n(&stripe->thin, &unlocked, (uintptr_t)object,
+        NO, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+  {
+    __atomic_store_n(&stripe->thinOwner, &threadIdentity, __ATOMIC_RELAXED);
+    stripe->thinDepth = 1;
+    return 0;
+  }
+  if (ownsThinLock(stripe, object))
+  {
+    stripe->thinDepth++;
+    return 0;
+  }
+  struct monitor *m;
+  uintptr_t thin;
+  {
+    LOCK_FOR_SCOPE(&stripe->lock);
+    m = findMonitor(stripe, object);
+    if (NULL == m)
+    {
+      m = addMonitor(stripe, object);
+    }
+    // The monitor can not be removed while it has users, so it is safe to
+    // wait for it after releasing the stripe lock.
+    m->users++;
+    thin = __atomic_fetch_or(&stripe->thin, THIN_LOCK_INFLATED,
+                             __ATOMIC_ACQUIRE);
+  }
+  // The thin lock can not be taken again while the stripe has monitors, so
+  // once its owner has released it the monitor is all that protects the
+  // object.
+  while ((thin & ~THIN_LOCK_INFLATED) == (uintptr_t)object)
+  {
+    sched_yield();
+    thin = __atomic_load_n(&stripe->thin, __ATOMIC_ACQUIRE);
+  }
+  LOCK(&m->lock);
+  m->depth++;
+  return 0;
+}
+
+int objc_sync_exit(id object)
+{
+  if ((object == 0) || isSmallObject(object)) { return 0; }
+  struct monitor_stripe *stripe = stripeForObject(object);
+  if (ownsThinLock(stripe, object))
+  {
+    if (0 == --stripe->thinDepth)
+    {
+      __atomic_store_n(&stripe->thinOwner, NULL, __ATOMIC_RELAXED);
+      // Keep the flag if other threads have inflated the object meanwhile.
+      __atomic_fetch_and(&stripe->thin, THIN_LOCK_INFLATED, __ATOMIC_RELEASE);
+    }
+    return 0;
+  }
+  LOCK_FOR_SCOPE(&stripe->lock);
+  struct monitor *m = findMonitor(stripe, object);
+  // The lock is recursive, so this only succeeds if the calling thread owns
+  // the monitor or nobody does.
+  if ((NULL == m) || !TRYLOCK(&m->lock))
+  {
+    return 1;
+  }
+  if (0 == m->depth)
+  {
+    UNLOCK(&m->lock);
+    return 1;
+  }
+  m->depth--;
+  UNLOCK(&m->lock);
+  UNLOCK(&m->lock);
+  if (0 == --m->users)
+  {
+    removeMonitor(stripe, m);
+  }
+  return 0;
+}